@@ -42,6 +42,9 @@ IF (SQLITE_INCLUDE_DIR AND SQLITE_LIBRARY)
   
   INCLUDE(CheckFunctionExists)
   CHECK_FUNCTION_EXISTS(sqlite3_column_database_name ZORBA_SQLITE_HAVE_METADATA)
+  # Database images need SQLite 3.23 or later, not built with
+  # SQLITE_OMIT_DESERIALIZE
+  CHECK_FUNCTION_EXISTS(sqlite3_deserialize ZORBA_SQLITE_HAVE_SERIALIZE)
 ELSE (SQLITE_INCLUDE_DIR AND SQLITE_LIBRARY)
   SET (SQLITE_FOUND 0)
   SET (SQLITE_LIBRARIES)
@@ -22,5 +22,6 @@
 
 #cmakedefine SQLITE_WITH_FILE_ACCESS
 #cmakedefine ZORBA_SQLITE_HAVE_METADATA
+#cmakedefine ZORBA_SQLITE_HAVE_SERIALIZE
 
 #endif /* ZORBA_SQLITE_CONFIG_H */
@@ -0,0 +1,255 @@
+/*
+ * Copyright 2012 The FLWOR Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZORBA_SQLITE_HANDLES_H
+#define ZORBA_SQLITE_HANDLES_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "sqlite_threads.h"
+
+namespace zorba { namespace sqlite {
+
+  enum HandleKind { HANDLE_CONNECTION = 1, HANDLE_STATEMENT = 2, HANDLE_BLOB = 3,
+                    HANDLE_ASYNC = 4 };
+
+/*******************************************************************************
+ * Registry of the objects handed out to queries as xs:anyURI handles.
+ *
+ * A handle is formatted like a UUID but carries the slot of the object, the
+ * generation of the slot, the kind of object and a random value picked when
+ * the table is created:
+ *
+ *   iiiiiiii-gggg-gggg-kkkk-rrrrrrrrrrrr
+ *
+ * so a lookup parses the handle and goes to the slot directly. The
+ * generation of a slot changes every time it is freed, handles to removed
+ * objects (or handles of another table) are stale instead of pointing to
+ * whatever took the slot afterwards. Slots are allocated in chunks that
+ * never move, nothing is allocated per handle.
+ ******************************************************************************/
+  template <class T>
+  class HandleTable
+  {
+    public:
+      enum { CHUNK_SIZE = 64, HANDLE_LENGTH = 36 };
+
+    private:
+      class Slot
+      {
+        public:
+          T* theValue;
+          unsigned int theGeneration;
+          unsigned int theNextFree;   // index + 1 of the next free slot
+      };
+
+      std::vector<Slot*> theChunks;
+      unsigned int theSize;           // slots ever used
+      unsigned int theFreeHead;       // index + 1 of the first free slot
+      unsigned int theCount;          // slots holding an object
+      unsigned int theKind;
+      sqlite3_uint64 theNonce;
+      mutable Mutex theMutex;
+
+      // Not copyable
+      HandleTable(const HandleTable&);
+      HandleTable& operator=(const HandleTable&);
+
+      Slot&
+        getSlot(unsigned int aIndex) const
+        { return theChunks[aIndex / CHUNK_SIZE][aIndex % CHUNK_SIZE]; }
+
+      static bool
+        parseHex(const char* aStr, int aLength, sqlite3_uint64& aValue)
+      {
+        aValue = 0;
+        for(int i=0; i<aLength; i++)
+        {
+          char c = aStr[i];
+          aValue <<= 4;
+          if(c >= '0' && c <= '9')
+            aValue |= c - '0';
+          else if(c >= 'a' && c <= 'f')
+            aValue |= c - 'a' + 10;
+          else
+            return false;
+        }
+        return true;
+      }
+
+      // The caller holds theMutex
+      Slot*
+        find(const char* aHandle, size_t aLength, unsigned int* aIndex = NULL) const
+      {
+        sqlite3_uint64 lIndex, lGenHigh, lGenLow, lKind, lNonce;
+        const char* lStr = aHandle;
+
+        if(aLength != HANDLE_LENGTH ||
+           lStr[8] != '-' || lStr[13] != '-' || lStr[18] != '-' || lStr[23] != '-' ||
+           !parseHex(lStr, 8, lIndex) ||
+           !parseHex(lStr + 9, 4, lGenHigh) ||
+           !parseHex(lStr + 14, 4, lGenLow) ||
+           !parseHex(lStr + 19, 4, lKind) ||
+           !parseHex(lStr + 24, 12, lNonce))
+          return NULL;
+        if(lKind != theKind || lNonce != theNonce || lIndex >= theSize)
+          return NULL;
+
+        Slot& lSlot = getSlot((unsigned int)lIndex);
+        if(lSlot.theValue == NULL ||
+           lSlot.theGeneration != (unsigned int)((lGenHigh << 16) | lGenLow))
+          return NULL;
+        if(aIndex != NULL)
+          *aIndex = (unsigned int)lIndex;
+        return &lSlot;
+      }
+
+    public:
+      HandleTable(HandleKind aKind)
+        : theSize(0), theFreeHead(0), theCount(0), theKind(aKind), theNonce(0)
+      {
+        sqlite3_randomness(sizeof(theNonce), &theNonce);
+        theNonce &= ((sqlite3_uint64)1 << 48) - 1;
+      }
+
+      ~HandleTable()
+      {
+        for(size_t i=0; i<theChunks.size(); i++)
+          delete[] theChunks[i];
+      }
+
+      // Registers aValue and returns its handle
+      std::string
+        add(T* aValue)
+      {
+        unsigned int lIndex;
+        unsigned int lGeneration;
+        {
+          MutexLock lLock(theMutex);
+          if(theFreeHead != 0)
+          {
+            lIndex = theFreeHead - 1;
+            theFreeHead = getSlot(lIndex).theNextFree;
+          }
+          else
+          {
+            if(theSize % CHUNK_SIZE == 0)
+            {
+              Slot* lChunk = new Slot[CHUNK_SIZE];
+              for(int i=0; i<CHUNK_SIZE; i++)
+              {
+                lChunk[i].theValue = NULL;
+                lChunk[i].theGeneration = 0;
+                lChunk[i].theNextFree = 0;
+              }
+              theChunks.push_back(lChunk);
+            }
+            lIndex = theSize++;
+          }
+          Slot& lSlot = getSlot(lIndex);
+          lSlot.theValue = aValue;
+          lGeneration = lSlot.theGeneration;
+          ++theCount;
+        }
+
+        char lHandle[HANDLE_LENGTH + 1];
+        sprintf(lHandle, "%08x-%04x-%04x-%04x-%012llx",
+                lIndex, (lGeneration >> 16) & 0xffff, lGeneration & 0xffff,
+                theKind, (unsigned long long)theNonce);
+        return std::string(lHandle, HANDLE_LENGTH);
+      }
+
+      // NULL if the handle is not valid or stale
+      T*
+        get(const std::string& aHandle) const
+      {
+        return get(aHandle.c_str(), aHandle.size());
+      }
+
+      // Same, for a handle embedded in a longer string
+      T*
+        get(const char* aHandle, size_t aLength) const
+      {
+        MutexLock lLock(theMutex);
+        Slot* lSlot = find(aHandle, aLength);
+        return (lSlot == NULL)?NULL:lSlot->theValue;
+      }
+
+      // Frees the slot and returns what it held (NULL if the handle is not
+      // valid), the caller takes care of releasing it
+      T*
+        remove(const std::string& aHandle)
+      {
+        MutexLock lLock(theMutex);
+        unsigned int lIndex;
+        Slot* lSlot = find(aHandle.c_str(), aHandle.size(), &lIndex);
+        if(lSlot == NULL)
+          return NULL;
+
+        T* lValue = lSlot->theValue;
+        lSlot->theValue = NULL;
+        ++lSlot->theGeneration;
+        lSlot->theNextFree = theFreeHead;
+        theFreeHead = lIndex + 1;
+        --theCount;
+        return lValue;
+      }
+
+      // Frees every slot and hands back what they held
+      void
+        removeAll(std::vector<T*>& aValues)
+      {
+        MutexLock lLock(theMutex);
+        for(unsigned int i=0; i<theSize; i++)
+        {
+          Slot& lSlot = getSlot(i);
+          if(lSlot.theValue == NULL)
+            continue;
+          aValues.push_back(lSlot.theValue);
+          lSlot.theValue = NULL;
+          ++lSlot.theGeneration;
+          lSlot.theNextFree = theFreeHead;
+          theFreeHead = i + 1;
+        }
+        theCount = 0;
+      }
+
+      void
+        getAll(std::vector<T*>& aValues) const
+      {
+        MutexLock lLock(theMutex);
+        for(unsigned int i=0; i<theSize; i++)
+        {
+          if(getSlot(i).theValue != NULL)
+            aValues.push_back(getSlot(i).theValue);
+        }
+      }
+
+      unsigned int
+        size() const
+      {
+        MutexLock lLock(theMutex);
+        return theCount;
+      }
+  };
+
+} /* namespace sqlite  */ } /* namespace zorba */
+
+#endif /* ZORBA_SQLITE_HANDLES_H */
@@ -14,7 +14,15 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <sstream>
 #include <string>
 #include <memory>
@@ -29,7 +37,7 @@
 #include <zorba/util/base64_stream.h>
 #include <zorba/util/base64_util.h>
 #include <zorba/util/transcode_stream.h>
-#include <zorba/util/uuid.h>
+#include <zorba/vector_item_sequence.h>
 
 #include "sqlite_module/config.h"
 #include "sqlite_module.h"
@@ -37,6 +45,8 @@
 namespace zorba { namespace sqlite {
 
 // Allocating global variables
+Mutex SqliteModule::theKeysMutex;
+bool SqliteModule::theKeysCreated = false;
 zorba::Item SqliteModule::globalNameKey;
 zorba::Item SqliteModule::globalDatabaseKey;
 zorba::Item SqliteModule::globalTableKey;
@@ -51,6 +61,12 @@ zorba::Item SqliteModule::globalAffectedRowsKey;
  ******************************************************************************/
 SqliteModule::SqliteModule()
 {
+  // The keys are shared by every instance of the module, other threads may
+  // be using them already
+  MutexLock lLock(theKeysMutex);
+  if(theKeysCreated)
+    return;
+  theKeysCreated = true;
   globalNameKey = Zorba::getInstance(0)->getItemFactory()->createString("name");
   globalDatabaseKey = Zorba::getInstance(0)->getItemFactory()->createString("database");
   globalTableKey = Zorba::getInstance(0)->getItemFactory()->createString("table");
@@ -65,6 +81,7 @@ SqliteModule::SqliteModule()
 zorba::ExternalFunction*
 SqliteModule::getExternalFunction(const zorba::String& localName)
 {
+  MutexLock lLock(theFunctionsMutex);
   FuncMap_t::iterator lIte = theFunctions.find(localName);
 
   ExternalFunction*& lFunc = theFunctions[localName];
@@ -87,6 +104,14 @@ SqliteModule::getExternalFunction(const zorba::String& localName)
     {
       lFunc = new RollbackFunction(this);
     }
+    else if (localName == "begin-transaction")
+    {
+      lFunc = new BeginTransactionFunction(this);
+    }
+    else if (localName == "transaction-state")
+    {
+      lFunc = new TransactionStateFunction(this);
+    }
     else if (localName == "execute-query")
     {
       lFunc = new ExecuteQueryFunction(this);
@@ -139,6 +164,126 @@ SqliteModule::getExternalFunction(const zorba::String& localName)
       {
         lFunc = new ExecuteUpdatePreparedFunction(this);
       }
+      else if (localName == "bind")
+      {
+        lFunc = new BindFunction(this);
+      }
+      else if (localName == "execute-batch")
+      {
+        lFunc = new ExecuteBatchFunction(this);
+      }
+      else if (localName == "statement-cache-stats")
+      {
+        lFunc = new StatementCacheStatsFunction(this);
+      }
+      else if (localName == "live-statements")
+      {
+        lFunc = new LiveStatementsFunction(this);
+      }
+      else if (localName == "connection-settings")
+      {
+        lFunc = new ConnectionSettingsFunction(this);
+      }
+      else if (localName == "connect-pooled")
+      {
+        lFunc = new ConnectPooledFunction(this);
+      }
+      else if (localName == "pool-stats")
+      {
+        lFunc = new PoolStatsFunction(this);
+      }
+      else if (localName == "set-trace")
+      {
+        lFunc = new SetTraceFunction(this);
+      }
+      else if (localName == "trace-stats")
+      {
+        lFunc = new TraceStatsFunction(this);
+      }
+      else if (localName == "statement-stats")
+      {
+        lFunc = new StatementStatsFunction(this);
+      }
+      else if (localName == "connection-stats")
+      {
+        lFunc = new ConnectionStatsFunction(this);
+      }
+      else if (localName == "explain")
+      {
+        lFunc = new ExplainFunction(this);
+      }
+      else if (localName == "blob-open")
+      {
+        lFunc = new BlobOpenFunction(this);
+      }
+      else if (localName == "blob-size")
+      {
+        lFunc = new BlobSizeFunction(this);
+      }
+      else if (localName == "blob-read")
+      {
+        lFunc = new BlobReadFunction(this);
+      }
+      else if (localName == "blob-write")
+      {
+        lFunc = new BlobWriteFunction(this);
+      }
+      else if (localName == "blob-close")
+      {
+        lFunc = new BlobCloseFunction(this);
+      }
+      else if (localName == "execute-async")
+      {
+        lFunc = new ExecuteAsyncFunction(this);
+      }
+      else if (localName == "await")
+      {
+        lFunc = new AwaitFunction(this);
+      }
+      else if (localName == "await-any")
+      {
+        lFunc = new AwaitAnyFunction(this);
+      }
+      else if (localName == "execute-sharded")
+      {
+        lFunc = new ExecuteShardedFunction(this);
+      }
+      else if (localName == "table-info")
+      {
+        lFunc = new TableInfoFunction(this);
+      }
+      else if (localName == "execute-script")
+      {
+        lFunc = new ExecuteScriptFunction(this);
+      }
+      else if (localName == "interrupt")
+      {
+        lFunc = new InterruptFunction(this);
+      }
+      else if (localName == "backup")
+      {
+        lFunc = new BackupFunction(this);
+      }
+      else if (localName == "connect-from-binary")
+      {
+        lFunc = new ConnectFromBinaryFunction(this);
+      }
+      else if (localName == "serialize")
+      {
+        lFunc = new SerializeFunction(this);
+      }
+      else if (localName == "register-function")
+      {
+        lFunc = new RegisterFunctionFunction(this);
+      }
+      else if (localName == "close-pool")
+      {
+        lFunc = new ClosePoolFunction(this);
+      }
+      else if (localName == "interrupt-pool")
+      {
+        lFunc = new InterruptPoolFunction(this);
+      }
     }
 
     return lFunc;
@@ -157,6 +302,8 @@ SqliteModule::getExternalFunction(const zorba::String& localName)
       delete lIter->second;
     }
     theFunctions.clear();
+    // The pools and the async workers are shared by every instance of the
+    // module and outlive them, see ModuleState
   }
 
   zorba::Item&
@@ -179,1248 +326,5979 @@ SqliteModule::getExternalFunction(const zorba::String& localName)
   }
 
   /***********************
-   *       ConnMap       *
+   *   StatementCache    *
    ***********************/
 
-  ConnMap::ConnMap(StmtMap* stmtMap)
-  {
-    ConnMap::connMap = new ConnMap_t();
-    sMap = stmtMap;
-  }
+  StatementCache::StatementCache(sqlite3* aDb)
+    : theDb(aDb),
+      theCapacity(DEFAULT_CAPACITY),
+      theInUse(0),
+      theHits(0),
+      theMisses(0),
+      theEvictions(0) {}
 
-  bool 
-  ConnMap::storeConn(const std::string& aKeyName, sqlite3* sql)
+  StatementCache::~StatementCache()
   {
-    std::pair<ConnMap_t::iterator,bool> ret;
-    ret = connMap->insert(std::pair<std::string, sqlite3 *>(aKeyName, sql));
-    return ret.second;
+    clear();
   }
 
-  sqlite3*
-  ConnMap::getConn(const std::string& aKeyName)
+  sqlite3_stmt*
+  StatementCache::acquire(const std::string& aSql)
   {
-    ConnMap_t::iterator lIter = connMap->find(aKeyName);
+    MutexLock lLock(theMutex);
+    Index_t::iterator lIter = theIndex.find(aSql);
 
-    if(lIter == connMap->end())
-      return NULL;
-    
-    sqlite3 *lSql = lIter->second;
+    if(lIter == theIndex.end())
+    {
+      ++theMisses;
+      sqlite3_stmt* lStmt = SqliteFunction::prepareStatement(theDb, aSql);
+      if(lStmt != NULL)
+        ++theInUse;
+      return lStmt;
+    }
 
-    return lSql;
+    // The statement leaves the cache while it is in use so that nested
+    // executions of the same SQL text never share it
+    sqlite3_stmt* lStmt = lIter->second->second;
+    theEntries.erase(lIter->second);
+    theIndex.erase(lIter);
+    ++theHits;
+    ++theInUse;
+    sqlite3_reset(lStmt);
+    sqlite3_clear_bindings(lStmt);
+    return lStmt;
   }
 
-  bool
-  ConnMap::deleteConn(const std::string& aKeyName)
+  void
+  StatementCache::release(const std::string& aSql, sqlite3_stmt* aStmt)
   {
-    ConnMap::ConnMap_t::iterator lIter = connMap->find(aKeyName);
-
-    if(lIter == connMap->end())
-      return false;
-      
-    if(sMap != NULL)
-      sMap->deleteAllForConn(lIter->second);
-    sqlite3_close(lIter->second);
-    connMap->erase(lIter);
-    return true;
+    if(aStmt == NULL)
+      return;
+    MutexLock lLock(theMutex);
+    --theInUse;
+    sqlite3_reset(aStmt);
+    if(theCapacity == 0 || theIndex.find(aSql) != theIndex.end())
+    {
+      sqlite3_finalize(aStmt);
+      return;
+    }
+    theEntries.push_front(std::pair<std::string, sqlite3_stmt *>(aSql, aStmt));
+    theIndex[aSql] = theEntries.begin();
+    evict(theCapacity);
   }
 
   void
-  ConnMap::destroy() throw()
+  StatementCache::evict(unsigned int aSize)
   {
-    if(connMap)
+    while(theIndex.size() > aSize)
     {
-      if(sMap)
-        sMap->deleteAllForConn(NULL); // delete all prep-statements
-        
-      for (ConnMap_t::iterator lIter = connMap->begin();
-           lIter != connMap->end(); )
-      {
-        sqlite3_close(lIter->second);
-        connMap->erase(lIter++);
-      }
- //     connMap->clear();
-      delete connMap;
+      sqlite3_finalize(theEntries.back().second);
+      theIndex.erase(theEntries.back().first);
+      theEntries.pop_back();
+      ++theEvictions;
     }
-    delete this;
   }
-  
-  ConnMap::~ConnMap(){ }
-
-/***********************
- *       StmtMap       *
-***********************/
 
-  StmtMap::StmtMap()
+  void
+  StatementCache::clear()
   {
-    StmtMap::stmtMap = new StmtMap_t();
+    MutexLock lLock(theMutex);
+    for(Entries_t::iterator lIter = theEntries.begin();
+        lIter != theEntries.end(); ++lIter)
+    {
+      sqlite3_finalize(lIter->second);
+    }
+    theEntries.clear();
+    theIndex.clear();
   }
 
-  bool 
-  StmtMap::storeStmt(const std::string& aKeyName, sqlite3_stmt* stmt)
+  void
+  StatementCache::setCapacity(unsigned int aCapacity)
   {
-    std::pair<StmtMap_t::iterator,bool> ret;
-    ret = stmtMap->insert(std::pair<std::string, sqlite3_stmt *>(aKeyName, stmt));
-    return ret.second;
+    MutexLock lLock(theMutex);
+    theCapacity = aCapacity;
+    evict(theCapacity);
   }
 
-  sqlite3_stmt*
-  StmtMap::getStmt(const std::string& aKeyName)
-  {
-    StmtMap_t::iterator lIter = stmtMap->find(aKeyName);
+  /***********************
+   *     ScriptCache     *
+   ***********************/
 
-    if(lIter == stmtMap->end())
-      return NULL;
-    
-    sqlite3_stmt *lStmt = lIter->second;
+  ScriptCache::~ScriptCache()
+  {
+    clear();
+  }
 
-    return lStmt;
+  void
+  ScriptCache::finalize(Script_t& aScript)
+  {
+    for(size_t i=0; i<aScript.size(); i++)
+      sqlite3_finalize(aScript[i]);
+    aScript.clear();
   }
 
   bool
-  StmtMap::deleteStmt(const std::string& aKeyName)
+  ScriptCache::acquire(const std::string& aSql, Script_t& aScript)
   {
-    StmtMap::StmtMap_t::iterator lIter = stmtMap->find(aKeyName);
+    MutexLock lLock(theMutex);
+    Index_t::iterator lIter = theIndex.find(aSql);
 
-    if(lIter == stmtMap->end())
+    aScript.clear();
+    if(lIter == theIndex.end())
       return false;
-
-    sqlite3_finalize(lIter->second);
-    stmtMap->erase(lIter);
+    // Out of the cache while it runs, like the single statements
+    aScript.swap(lIter->second->second);
+    theEntries.erase(lIter->second);
+    theIndex.erase(lIter);
     return true;
   }
 
   void
-  StmtMap::destroy() throw()
+  ScriptCache::release(const std::string& aSql, Script_t& aScript)
   {
-    if(stmtMap)
+    for(size_t i=0; i<aScript.size(); i++)
+      sqlite3_reset(aScript[i]);
+    MutexLock lLock(theMutex);
+    if(theIndex.find(aSql) != theIndex.end())
     {
-      for (StmtMap_t::iterator lIter = stmtMap->begin();
-           lIter != stmtMap->end(); )
-      {
-        sqlite3_finalize(lIter->second);
-        stmtMap->erase(lIter++);
-      }
-      delete stmtMap;
+      finalize(aScript);
+      return;
+    }
+    theEntries.push_front(std::pair<std::string, Script_t>(aSql, Script_t()));
+    theEntries.front().second.swap(aScript);
+    theIndex[aSql] = theEntries.begin();
+    while(theIndex.size() > theCapacity)
+    {
+      finalize(theEntries.back().second);
+      theIndex.erase(theEntries.back().first);
+      theEntries.pop_back();
     }
-    delete this;
   }
-  
+
   void
-  StmtMap::deleteAllForConn(sqlite3* c)
+  ScriptCache::clear()
   {
-    StmtMap_t::iterator it;
-    for(it = stmtMap->begin();
-        it != stmtMap->end(); )
+    MutexLock lLock(theMutex);
+    for(Entries_t::iterator lIter = theEntries.begin();
+        lIter != theEntries.end(); ++lIter)
     {
-      if((c == NULL) || (sqlite3_db_handle(it->second) == c))
-      {
-        sqlite3_finalize(it->second);
-        stmtMap->erase(it++);
-      } else
-        it++;
+      finalize(lIter->second);
     }
+    theEntries.clear();
+    theIndex.clear();
   }
 
-  StmtMap::~StmtMap(){ }
+  /***********************
+   *     QueryTimer      *
+   ***********************/
 
-/*******************************************************************************
- *                              SqliteFunction                                 *
- *******************************************************************************/
-  SqliteFunction::SqliteFunction(const SqliteModule* aModule)
-    : theModule(aModule) {}
+  int
+  QueryTimer::callback(void* aTimer)
+  {
+    // Called by SQLite with the database mutex held, like step() sets
+    // theDeadline
+    QueryTimer* lTimer = static_cast<QueryTimer*>(aTimer);
+    return (lTimer->theDeadline != 0 &&
+            currentTimeMillis() >= lTimer->theDeadline)?1:0;
+  }
 
-  SqliteFunction::~SqliteFunction(){}
+  sqlite3_int64
+  QueryTimer::getDeadline(int aTimeout) const
+  {
+    int lTimeout = (aTimeout < 0)?theTimeout:aTimeout;
+    if(lTimeout == 0)
+      return 0;
+    return currentTimeMillis() + lTimeout;
+  }
 
-  ConnMap*
-  SqliteFunction::getConnectionMap(const zorba::DynamicContext* aDctx){
-    DynamicContext* lDynCtx = const_cast<DynamicContext*>(aDctx);
-    ConnMap* lConnMap;
-    StmtMap* lStmtMap;
-    if(!(lConnMap = dynamic_cast<ConnMap*>(lDynCtx->getExternalFunctionParameter("sqliteConnMap"))))
+  int
+  QueryTimer::step(sqlite3_stmt* aStmt, sqlite3_int64 aDeadline)
+  {
+    if(aDeadline == 0)
+      return sqlite3_step(aStmt);
+
+    // The database mutex is recursive, holding it around sqlite3_step()
+    // keeps statements stepped on other threads from seeing this deadline
+    sqlite3_mutex* lMutex = sqlite3_db_mutex(theDb);
+    sqlite3_mutex_enter(lMutex);
+    // The handler is only there while a deadline is active, statements
+    // without one don't pay for it
+    if(!theInstalled)
     {
-      lStmtMap = getStatementMap(lDynCtx);
-      lConnMap = new ConnMap(lStmtMap);
-      lDynCtx->addExternalFunctionParameter("sqliteConnMap", lConnMap);     
+      sqlite3_progress_handler(theDb, CHECK_INTERVAL, &QueryTimer::callback, this);
+      theInstalled = true;
     }
-    return lConnMap;
+    // A statement stepped while another one runs gets no more time than it
+    sqlite3_int64 lOuter = theDeadline;
+    theDeadline = (lOuter != 0 && lOuter < aDeadline)?lOuter:aDeadline;
+    int lRc = sqlite3_step(aStmt);
+    theDeadline = lOuter;
+    if(theDeadline == 0)
+    {
+      sqlite3_progress_handler(theDb, 0, NULL, NULL);
+      theInstalled = false;
+    }
+    sqlite3_mutex_leave(lMutex);
+    return lRc;
   }
 
-  StmtMap*
-  SqliteFunction::getStatementMap(const zorba::DynamicContext* aDctx){
-    DynamicContext* lDynCtx = const_cast<DynamicContext*>(aDctx);
-    StmtMap* lStmtMap;
-    if(!(lStmtMap = dynamic_cast<StmtMap*>(lDynCtx->getExternalFunctionParameter("sqliteStmtMap"))))
+  /***********************
+   *        Blob         *
+   ***********************/
+
+  Blob::Blob(sqlite3* aDb,
+             const std::string& aDatabase,
+             const std::string& aTable,
+             const std::string& aColumn,
+             sqlite3_int64 aRowid,
+             bool aWritable)
+    : theDb(aDb), theDatabase(aDatabase), theTable(aTable), theColumn(aColumn),
+      theRowid(aRowid), theWritable(aWritable), theBlob(NULL)
+  {
+    int lRc = sqlite3_blob_open(theDb, theDatabase.c_str(), theTable.c_str(),
+                                theColumn.c_str(), theRowid, theWritable?1:0,
+                                &theBlob);
+    if(lRc != SQLITE_OK)
     {
-      lStmtMap = new StmtMap();
-      lDynCtx->addExternalFunctionParameter("sqliteStmtMap", lStmtMap);     
+      std::string lErr = sqlite3_errmsg(theDb);
+      sqlite3_blob_close(theBlob);
+      SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
     }
-    return lStmtMap;
   }
 
-  std::string
-  SqliteFunction::createUUID(){
-    uuid lUUID;
-    uuid::create(&lUUID);
-    std::stringstream lStream;
-    lStream << lUUID;
-    return lStream.str();
+  Blob::~Blob()
+  {
+    sqlite3_blob_close(theBlob);
   }
 
-  sqlite3_stmt* 
-  SqliteFunction::createPreparedStatement(const zorba::DynamicContext* aDctx,
-                                          std::string aUUID, std::string aQry){
-    sqlite3 *lDb;
-    sqlite3_stmt *lPstmt;
-    int lRc;
-    const char *lTail;
-    ConnMap* lConnMap = SqliteFunction::getConnectionMap(aDctx);
+  int
+  Blob::read(char* aBuffer, int aLength, int aOffset)
+  {
+    return sqlite3_blob_read(theBlob, aBuffer, aLength, aOffset);
+  }
 
-    lDb = lConnMap->getConn(aUUID);
-    if(lDb == NULL){
-      // throw error, ID not recognized
-      throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
-    }
+  int
+  Blob::write(const char* aBuffer, int aLength, int aOffset)
+  {
+    return sqlite3_blob_write(theBlob, aBuffer, aLength, aOffset);
+  }
 
-    lRc = sqlite3_prepare_v2(lDb, aQry.c_str(), aQry.size(), &lPstmt, &lTail);
-    if(lRc != 0 && lPstmt != NULL){
-      sqlite3_finalize(lPstmt);
-    }
-    if(lRc == SQLITE_ERROR) {
-      std::string lErr = getErrorMessage("INVALID-SQL-STATEMENT");
-      lErr += "; ";
-      lErr += sqlite3_errmsg(lDb);
-      throwError("INVALID-SQL-STATEMENT", lErr.c_str());
-    } else
-      checkForError(lRc, 0, lDb);
+  Blob*
+  Blob::openReader() const
+  {
+    return new Blob(theDb, theDatabase, theTable, theColumn, theRowid, false);
+  }
 
-    return lPstmt;
+  BlobStreamBuf::int_type
+  BlobStreamBuf::underflow()
+  {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+
+    int lLength = theBlob->getSize() - theOffset;
+    if(lLength > Blob::CHUNK_SIZE)
+      lLength = Blob::CHUNK_SIZE;
+    if(lLength <= 0)
+      return traits_type::eof();
+    // A blob whose row was changed meanwhile can't be read anymore
+    if(theBlob->read(theBuffer, lLength, theOffset) != SQLITE_OK)
+      SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM",
+                                 sqlite3_errmsg(theBlob->getDb()));
+
+    theOffset += lLength;
+    setg(theBuffer, theBuffer, theBuffer + lLength);
+    return traits_type::to_int_type(*gptr());
   }
 
-  void
-  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
-    std::string aUUID, 
-    int aPos, bool aVal)
+  /***********************
+   *     TraceStats      *
+   ***********************/
+
+  int
+  TraceStats::callback(unsigned int aType, void* aCtx, void* aP, void* aX)
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    int lRc;
-    
-    // Get the prepared statement and then set the value
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    TraceStats* lTrace = static_cast<TraceStats*>(aCtx);
+    sqlite3_stmt* lStmt = static_cast<sqlite3_stmt*>(aP);
+    const char* lSql = sqlite3_sql(lStmt);
+
+    if(lSql == NULL)
+      return 0;
+    Entry& lEntry = lTrace->theEntries[lSql];
+    if(aType == SQLITE_TRACE_ROW)
+      ++lEntry.theRows;
+    else if(aType == SQLITE_TRACE_PROFILE)
+    {
+      sqlite3_int64 lNanos = *static_cast<sqlite3_int64*>(aX);
+      ++lEntry.theCalls;
+      lEntry.theTotalNanos += lNanos;
+      if(lNanos > lEntry.theMaxNanos)
+        lEntry.theMaxNanos = lNanos;
+      if(lTrace->theSlowNanos > 0 && lNanos >= lTrace->theSlowNanos)
+        lTrace->logSlowQuery(lStmt, lNanos);
     }
-    lRc = sqlite3_bind_int(lPstmt, aPos, (aVal==true)?1:0);
-    if(lRc == SQLITE_RANGE)
-      throwError("INVALID-PLACEHOLDER-POSITION",
-                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
-    else
-      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+    return 0;
   }
 
   void
-  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
-    std::string aUUID, 
-    int aPos, 
-    int aVal)
+  TraceStats::logSlowQuery(sqlite3_stmt* aStmt, sqlite3_int64 aNanos)
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    int lRc;
-    
-    // Get the prepared statement and then set the value
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    ++theSlowQueries;
+    if(!theSlowLogStream.is_open())
+      return;
+    // Called from SQLite, errors writing the log are ignored
+    char* lSql = sqlite3_expanded_sql(aStmt);
+    theSlowLogStream << (aNanos / 1000000) << " ms: "
+                     << (lSql?lSql:sqlite3_sql(aStmt)) << std::endl;
+    sqlite3_free(lSql);
+  }
+
+  void
+  TraceStats::enable(bool aProfile, bool aRows, sqlite3_int64 aSlowMillis,
+                     const std::string& aSlowLog)
+  {
+    theMask = (aProfile?SQLITE_TRACE_PROFILE:0) | (aRows?SQLITE_TRACE_ROW:0);
+    theSlowNanos = aProfile?aSlowMillis * 1000000:0;
+    // The log stays open while tracing is enabled, it is only reopened when
+    // the file changes
+    if(theSlowNanos == 0 || aSlowLog != theSlowLog)
+    {
+      if(theSlowLogStream.is_open())
+        theSlowLogStream.close();
+      theSlowLogStream.clear();
     }
-    lRc = sqlite3_bind_int(lPstmt, aPos, aVal);
-    if(lRc == SQLITE_RANGE)
-      throwError("INVALID-PLACEHOLDER-POSITION",
-                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    theSlowLog = aSlowLog;
+    if(theSlowNanos > 0 && !theSlowLog.empty() && !theSlowLogStream.is_open())
+      theSlowLogStream.open(theSlowLog.c_str(), std::ios::out | std::ios::app);
+    if(theMask == 0)
+      disable();
     else
-      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+      SqliteFunction::checkForError(
+        sqlite3_trace_v2(theDb, theMask, &TraceStats::callback, this), 0, theDb);
   }
 
   void
-  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
-    std::string aUUID,
-    int aPos,
-    double aVal)
+  TraceStats::disable()
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);\
-    int lRc;
-    
-    // Get the prepared statement and then set the value
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
-    }
-    lRc = sqlite3_bind_double(lPstmt, aPos, aVal);
-    if(lRc == SQLITE_RANGE)
-      throwError("INVALID-PLACEHOLDER-POSITION",
-                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
-    else
-      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+    if(theMask != 0)
+      sqlite3_trace_v2(theDb, 0, NULL, NULL);
+    theMask = 0;
+    theSlowNanos = 0;
+    if(theSlowLogStream.is_open())
+      theSlowLogStream.close();
+    theSlowLogStream.clear();
   }
 
   void
-  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
-    std::string aUUID,
-    int aPos,
-    std::string aVal)
+  TraceStats::reset()
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    int lRc;
-    
-    // Get the prepared statement and then set the value
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
-    }
-    lRc = sqlite3_bind_text(lPstmt, aPos, aVal.c_str(), aVal.size(), SQLITE_TRANSIENT);
-    if(lRc == SQLITE_RANGE)
-      throwError("INVALID-PLACEHOLDER-POSITION",
-                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
-    else
-      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+    theEntries.clear();
+    theSlowQueries = 0;
+  }
+
+  /***********************
+   *     Connection      *
+   ***********************/
+
+  unsigned int
+  Connection::getLiveStatements() const
+  {
+    // SQLite keeps the list of every statement not finalized yet
+    unsigned int lCount = 0;
+    for(sqlite3_stmt* lStmt = sqlite3_next_stmt(theDb, NULL);
+        lStmt != NULL; lStmt = sqlite3_next_stmt(theDb, lStmt))
+      ++lCount;
+    return lCount;
   }
 
   void
-  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
-    std::string aUUID,
-    int aPos)
+  Connection::close()
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    int lRc;
-    
-    // Get the prepared statement and then set the value
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
-    }
-    lRc = sqlite3_bind_null(lPstmt, aPos);
-    if(lRc == SQLITE_RANGE)
-      throwError("INVALID-PLACEHOLDER-POSITION",
-                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
-    else
-      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+    // Cached statements and blob handles must be closed before the database
+    theTrace.disable();
+    closeBlobs();
+    theStmtCache.clear();
+    theScripts.clear();
+    theSchema.close();
+    // The function items go away with the query, not with a zombie database
+    dropFunctions();
+    // Streamed blob values keep a handle of their own, the database is
+    // only closed once they are done with it
+    sqlite3_close_v2(theDb);
   }
 
   void
-  SqliteFunction::clearValues(const zorba::DynamicContext* aDctx,
-    std::string aUUID)
+  Connection::addFunction(const std::string& aName, int aArity)
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    	
-    // get the prepared statement if exists
-    lPstmt = stmtMap->getStmt(aUUID);
-    if(lPstmt == NULL){
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    std::pair<std::string, int> lFunction(aName, aArity);
+    if(std::find(theFunctions.begin(), theFunctions.end(), lFunction) == theFunctions.end())
+      theFunctions.push_back(lFunction);
+  }
+
+  bool
+  Connection::dropFunctions()
+  {
+    // SQLite refuses while a statement is running, the functions stay with
+    // the database until it is closed
+    bool lDropped = true;
+    for(size_t i=0; i<theFunctions.size(); i++)
+    {
+      if(sqlite3_create_function_v2(theDb, theFunctions[i].first.c_str(),
+                                    theFunctions[i].second, SQLITE_UTF8,
+                                    NULL, NULL, NULL, NULL, NULL) != SQLITE_OK)
+        lDropped = false;
     }
-    sqlite3_clear_bindings(lPstmt);
+    theFunctions.clear();
+    return lDropped;
   }
 
-  String 
-  SqliteFunction::getURI() const
+  std::string
+  Connection::addBlob(Blob* aBlob)
   {
-    return theModule->getURI();
+    return theBlobs.add(aBlob);
+  }
+
+  Blob*
+  Connection::getBlob(const char* aUUID, size_t aLength)
+  {
+    return theBlobs.get(aUUID, aLength);
+  }
+
+  bool
+  Connection::closeBlob(const std::string& aUUID)
+  {
+    Blob* lBlob = theBlobs.remove(aUUID);
+    delete lBlob;
+    return lBlob != NULL;
   }
 
   void
-  SqliteFunction::throwError(
-        const char* aLocalName,
-        const char* aErrorMessage)
+  Connection::closeBlobs()
   {
-    String errNS(SqliteModule::getModuleURI());
-    Item errQName = SqliteModule::getItemFactory()->createQName(
-        errNS, aLocalName);
-    throw USER_EXCEPTION(errQName, aErrorMessage);
+    std::vector<Blob*> lBlobs;
+    theBlobs.removeAll(lBlobs);
+    for(size_t i=0; i<lBlobs.size(); i++)
+      delete lBlobs[i];
   }
 
   void
-  SqliteFunction::checkForError(
-        int aErrNo,
-        const char* aLocalName,
-        sqlite3 *sql)
+  Connection::beginTransaction(TX_MODE aMode)
   {
-    if (aErrNo != SQLITE_OK)
+    switch(aMode)
     {
-      if (!aLocalName)
-      {
-        throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errmsg(sql));
-      }
-      else
-      {
-        throwError(aLocalName, sqlite3_errmsg(sql));
-      }
+    case TX_IMMEDIATE:
+      SqliteFunction::executeSql(theDb, "BEGIN IMMEDIATE TRANSACTION");
+      break;
+    case TX_EXCLUSIVE:
+      SqliteFunction::executeSql(theDb, "BEGIN EXCLUSIVE TRANSACTION");
+      break;
+    default:
+      aMode = TX_DEFERRED;
+      SqliteFunction::executeSql(theDb, "BEGIN DEFERRED TRANSACTION");
     }
+    theTxMode = aMode;
   }
 
-  zorba::Item
-  SqliteFunction::getOneItem(const Arguments_t& aArgs, int aIndex)
+  void
+  Connection::commit()
   {
-    Item lItem;
-    Iterator_t args_iter = aArgs[aIndex]->getIterator();
-    args_iter->open();
-    args_iter->next(lItem);
-    args_iter->close();
+    // Outside of a transaction every statement is already committed
+    if(sqlite3_get_autocommit(theDb) == 0)
+      SqliteFunction::executeSql(theDb, "COMMIT TRANSACTION");
+    theTxMode = TX_NONE;
+  }
 
-    return lItem;
+  void
+  Connection::rollback()
+  {
+    if(sqlite3_get_autocommit(theDb) == 0)
+      SqliteFunction::executeSql(theDb, "ROLLBACK TRANSACTION");
+    theTxMode = TX_NONE;
   }
 
-  int
-  SqliteFunction::strToInt(std::string str){
-    int iInt;
-    sscanf(str.c_str(), "%d", &iInt);
-    return iInt;
+  Connection::TX_MODE
+  Connection::getTransactionMode()
+  {
+    // The transaction may have been ended (or started) by plain SQL
+    // commands, so SQLite has the last word on whether one is active
+    if(sqlite3_get_autocommit(theDb) != 0)
+      theTxMode = TX_NONE;
+    else if(theTxMode == TX_NONE)
+      theTxMode = TX_DEFERRED;
+    return theTxMode;
   }
 
-  double
-  SqliteFunction::strToDouble(std::string str){
-    double dDbl;
-    sscanf(str.c_str(), "%lf", &dDbl);
-    return dDbl;
+  Connection::TX_MODE
+  Connection::getModeFromString(const std::string& aMode)
+  {
+    if(aMode == "deferred")
+      return TX_DEFERRED;
+    else if(aMode == "immediate")
+      return TX_IMMEDIATE;
+    else if(aMode == "exclusive")
+      return TX_EXCLUSIVE;
+    SqliteFunction::throwError("INVALID-TRANSACTION-MODE",
+                               (std::string(SqliteFunction::getErrorMessage("INVALID-TRANSACTION-MODE")) + " - " +
+                                aMode).c_str());
+    return TX_NONE;
   }
 
-  const char *
-  SqliteFunction::getErrorMessage(std::string error){
-    if(error == "CANT-OPEN-DB")
-    {
-      return "Database file does not exist or it is not possible to open it";
-    } 
-    else if(error == "INVALID-SQLITE-OBJECT")
-    {
-      return "Connection ID passed is not valid";
-    }
-    else if(error == "INVALID-SQL-STATEMENT")
+  const char*
+  Connection::getModeAsString(TX_MODE aMode)
+  {
+    switch(aMode)
     {
-      return "Statement passed is not a valid SQL statement";
+    case TX_DEFERRED: return "deferred";
+    case TX_IMMEDIATE: return "immediate";
+    case TX_EXCLUSIVE: return "exclusive";
+    default: return "none";
     }
-    else if(error == "INVALID-PREPARED-STATEMENT")
+  }
+
+  /***********************
+   *     SchemaCache     *
+   ***********************/
+
+  int
+  SchemaCache::getCookie(sqlite3_stmt*& aStmt, const char* aPragma)
+  {
+    if(aStmt == NULL)
+      aStmt = SqliteFunction::prepareStatement(theDb, aPragma);
+    int lCookie = -1;
+    if(sqlite3_step(aStmt) == SQLITE_ROW)
+      lCookie = sqlite3_column_int(aStmt, 0);
+    sqlite3_reset(aStmt);
+    return lCookie;
+  }
+
+  sqlite3_stmt*
+  SchemaCache::preparePragma(const char* aPragma, const std::string& aTable)
+  {
+    char* lSql = sqlite3_mprintf("PRAGMA %s(%Q)", aPragma, aTable.c_str());
+    std::string lQry(lSql);
+    sqlite3_free(lSql);
+    return SqliteFunction::prepareStatement(theDb, lQry);
+  }
+
+  std::string
+  SchemaCache::getText(sqlite3_stmt* aStmt, int aColumn)
+  {
+    const char* lText = (const char*)sqlite3_column_text(aStmt, aColumn);
+    return (lText == NULL)?std::string():std::string(lText);
+  }
+
+  TableInfo*
+  SchemaCache::load(const std::string& aTable)
+  {
+    std::auto_ptr<TableInfo> lInfo(new TableInfo());
+    sqlite3_stmt* lStmt;
+
+    lInfo->theName = aTable;
+    lStmt = preparePragma("table_info", aTable);
+    while(sqlite3_step(lStmt) == SQLITE_ROW)
     {
-      return "Prepared statement passed is not valid";
+      TableInfo::Column lColumn;
+      lColumn.theName = getText(lStmt, 1);
+      lColumn.theType = getText(lStmt, 2);
+      lColumn.theNotNull = sqlite3_column_int(lStmt, 3) != 0;
+      lColumn.theHasDefault = sqlite3_column_type(lStmt, 4) != SQLITE_NULL;
+      lColumn.theDefault = getText(lStmt, 4);
+      lColumn.thePrimaryKey = sqlite3_column_int(lStmt, 5);
+      lInfo->theColumns.push_back(lColumn);
     }
-    else if(error == "INVALID-PLACEHOLDER-POSITION")
+    sqlite3_finalize(lStmt);
+    if(lInfo->theColumns.empty())
+      return NULL;
+
+    lStmt = preparePragma("index_list", aTable);
+    while(sqlite3_step(lStmt) == SQLITE_ROW)
     {
-      return "Parameter position passed is not valid";
+      TableInfo::Index lIndex;
+      lIndex.theName = getText(lStmt, 1);
+      lIndex.theUnique = sqlite3_column_int(lStmt, 2) != 0;
+      lIndex.theOrigin = getText(lStmt, 3);
+      lIndex.thePartial = sqlite3_column_int(lStmt, 4) != 0;
+      lInfo->theIndexes.push_back(lIndex);
     }
-    else if(error == "INVALID-VALUE")
+    sqlite3_finalize(lStmt);
+    for(size_t i=0; i<lInfo->theIndexes.size(); i++)
     {
-      return "Parameter passed is not a valid number";
+      // Expressions have no column name
+      lStmt = preparePragma("index_info", lInfo->theIndexes[i].theName);
+      while(sqlite3_step(lStmt) == SQLITE_ROW)
+        lInfo->theIndexes[i].theColumns.push_back(getText(lStmt, 2));
+      sqlite3_finalize(lStmt);
     }
-    else if(error == "UNKNOWN-OPTION")
+
+    // One row per column of every key, the rows of a key follow each other
+    lStmt = preparePragma("foreign_key_list", aTable);
+    while(sqlite3_step(lStmt) == SQLITE_ROW)
     {
-      return "Parameter passed is not a valid value";
+      int lId = sqlite3_column_int(lStmt, 0);
+      if(lInfo->theForeignKeys.empty() || lInfo->theForeignKeys.back().theId != lId)
+      {
+        TableInfo::ForeignKey lKey;
+        lKey.theId = lId;
+        lKey.theTable = getText(lStmt, 2);
+        lKey.theOnUpdate = getText(lStmt, 5);
+        lKey.theOnDelete = getText(lStmt, 6);
+        lInfo->theForeignKeys.push_back(lKey);
+      }
+      lInfo->theForeignKeys.back().theFrom.push_back(getText(lStmt, 3));
+      lInfo->theForeignKeys.back().theTo.push_back(getText(lStmt, 4));
     }
-#ifndef SQLITE_WITH_FILE_ACCESS
-    else if(error == "COMPILED-WITHOUT-DISK-ACCESS")
+    sqlite3_finalize(lStmt);
+    return lInfo.release();
+  }
+
+  const TableInfo*
+  SchemaCache::getTable(const std::string& aTable)
+  {
+    // Reading the cookies is much cheaper than the pragmas of a table
+    int lMainCookie = getCookie(theMainCookieStmt, "PRAGMA main.schema_version");
+    int lTempCookie = getCookie(theTempCookieStmt, "PRAGMA temp.schema_version");
+    if(lMainCookie != theMainCookie || lTempCookie != theTempCookie)
     {
-      return "Only in-memory databases are allowed (Module built without filesystem access)";
+      clear();
+      theMainCookie = lMainCookie;
+      theTempCookie = lTempCookie;
     }
-#endif /* not SQLITE_WITH_FILE_ACCESS */
-#ifndef ZORBA_SQLITE_HAVE_METADATA
-    else if(error == "UNAVAILABLE-METADATA")
+
+    // Table names are case insensitive
+    std::string lKey = aTable;
+    for(std::string::iterator lIter = lKey.begin(); lIter != lKey.end(); ++lIter)
+      *lIter = tolower(*lIter);
+    Tables_t::iterator lIter = theTables.find(lKey);
+    if(lIter != theTables.end())
+      return lIter->second;
+
+    TableInfo* lInfo = load(aTable);
+    theTables[lKey] = lInfo;
+    return lInfo;
+  }
+
+  void
+  SchemaCache::clear()
+  {
+    for(Tables_t::iterator lIter = theTables.begin(); lIter != theTables.end(); ++lIter)
+      delete lIter->second;
+    theTables.clear();
+    theMainCookie = -1;
+    theTempCookie = -1;
+  }
+
+  void
+  SchemaCache::close()
+  {
+    clear();
+    sqlite3_finalize(theMainCookieStmt);
+    sqlite3_finalize(theTempCookieStmt);
+    theMainCookieStmt = NULL;
+    theTempCookieStmt = NULL;
+  }
+
+  /***********************
+   *   ConnectionPool    *
+   ***********************/
+
+  ConnectionPool::Pools_t ConnectionPool::thePools;
+  std::vector<ConnectionPool*> ConnectionPool::theClosedPools;
+  Mutex ConnectionPool::thePoolsMutex;
+
+  ConnectionPool::ConnectionPool(const std::string& aPath,
+                                 const SqliteOptions& aOptions)
+    : thePath(aPath),
+      theOptions(new SqliteOptions(aOptions)),
+      theInUse(0),
+      theCreated(0),
+      theReused(0),
+      theClosed(false) {}
+
+  ConnectionPool::~ConnectionPool()
+  {
+    for(Idle_t::iterator lIter = theIdle.begin(); lIter != theIdle.end(); ++lIter)
+      closeConnection(lIter->first);
+    theIdle.clear();
+    delete theOptions;
+  }
+
+  ConnectionPool*
+  ConnectionPool::getPool(const std::string& aName,
+                          const std::string& aPath,
+                          const SqliteOptions& aOptions)
+  {
+    MutexLock lLock(thePoolsMutex);
+    Pools_t::iterator lIter = thePools.find(aName);
+
+    if(lIter != thePools.end())
     {
-      return "Metadata not found (SQLite built without SQLITE_ENABLE_COLUMN_METADATA)";
+      // The first request defines the database and options of the pool
+      if(lIter->second->thePath != aPath)
+        SqliteFunction::throwError("POOL-MISMATCH",
+                                   (std::string(SqliteFunction::getErrorMessage("POOL-MISMATCH")) + " - " +
+                                    aName).c_str());
+      return lIter->second;
     }
-#endif /* not ZORBA_SQLITE_HAVE_METADATA */
-    else if(error == "INTERNAL-SQLITE-PROBLEM")
+    ConnectionPool* lPool = new ConnectionPool(aPath, aOptions);
+    thePools[aName] = lPool;
+    return lPool;
+  }
+
+  ConnectionPool*
+  ConnectionPool::findPool(const std::string& aName)
+  {
+    MutexLock lLock(thePoolsMutex);
+    Pools_t::iterator lIter = thePools.find(aName);
+    return (lIter == thePools.end())?NULL:lIter->second;
+  }
+
+  bool
+  ConnectionPool::closePool(const std::string& aName)
+  {
+    ConnectionPool* lPool;
     {
-      return "Internal error ocurred";
+      MutexLock lLock(thePoolsMutex);
+      Pools_t::iterator lIter = thePools.find(aName);
+      if(lIter == thePools.end())
+        return false;
+      lPool = lIter->second;
+      thePools.erase(lIter);
+      theClosedPools.push_back(lPool);
     }
-    return "";
+    lPool->close();
+    return true;
   }
 
-  /********************
-   *  Sqlite Options  *
-   ********************/
-
-  SqliteOptions::SqliteOptions()
-    : theOpenReadOnly(false),
-      theOpenCreate(true),
-      theOpenNoMutex(false),
-      theOpenSharedCache(false) {}
+  bool
+  ConnectionPool::interruptPool(const std::string& aName)
+  {
+    MutexLock lLock(thePoolsMutex);
+    Pools_t::iterator lIter = thePools.find(aName);
+    if(lIter == thePools.end())
+      return false;
+    // A checked out connection is only closed by checkin(), under theMutex
+    ConnectionPool* lPool = lIter->second;
+    MutexLock lPoolLock(lPool->theMutex);
+    for(std::set<Connection*>::iterator lConn = lPool->theCheckedOut.begin();
+        lConn != lPool->theCheckedOut.end(); ++lConn)
+      sqlite3_interrupt((*lConn)->getDb());
+    return true;
+  }
 
   void
-  SqliteOptions::setValues(sqlite3* aSqlite)
+  ConnectionPool::closeAll()
   {
-    // TODO: check if it is possible to get those values from the sqlite3 pointer
+    MutexLock lLock(thePoolsMutex);
+    for(Pools_t::iterator lIter = thePools.begin(); lIter != thePools.end(); ++lIter)
+      theClosedPools.push_back(lIter->second);
+    thePools.clear();
+    // A pool with connections still checked out is left alone, they point
+    // to it
+    std::vector<ConnectionPool*> lInUse;
+    for(size_t i=0; i<theClosedPools.size(); i++)
+    {
+      ConnectionPool* lPool = theClosedPools[i];
+      lPool->close();
+      if(lPool->getInUse() == 0)
+        delete lPool;
+      else
+        lInUse.push_back(lPool);
+    }
+    theClosedPools.swap(lInUse);
   }
 
   void
-  SqliteOptions::setValues(Item& aOptions)
+  ConnectionPool::close()
   {
-    Item lItemJSONKey;
+    MutexLock lLock(theMutex);
+    theClosed = true;
+    for(Idle_t::iterator lIter = theIdle.begin(); lIter != theIdle.end(); ++lIter)
+      closeConnection(lIter->first);
+    theIdle.clear();
+  }
 
-    Iterator_t lIterKeys = aOptions.getObjectKeys();
-    lIterKeys->open();
-    while (lIterKeys->next(lItemJSONKey))
+  Connection*
+  ConnectionPool::checkout()
+  {
     {
-      Item lOptionValue;
-      lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
-
-      if (lItemJSONKey.getStringValue() == "open-read-only")
+      MutexLock lLock(theMutex);
+      collectIdle(currentTimeMillis());
+      while(!theIdle.empty())
       {
-        theOpenReadOnly = lOptionValue.getBooleanValue() == true;
-      }
-      else if (lItemJSONKey.getStringValue() == "open-create")
-      {
-        theOpenCreate = lOptionValue.getBooleanValue();
-      }
-      else if (lItemJSONKey.getStringValue() == "open-no-mutex")
-      {
-        theOpenNoMutex = lOptionValue.getBooleanValue();
+        Connection* lConn = theIdle.front().first;
+        theIdle.pop_front();
+        if(isValid(lConn))
+        {
+          ++theInUse;
+          ++theReused;
+          theCheckedOut.insert(lConn);
+          return lConn;
+        }
+        closeConnection(lConn);
       }
-      else if(lItemJSONKey.getStringValue() == "open-shared-cache")
-      {
-        theOpenSharedCache = lOptionValue.getBooleanValue();
-      } else
-        // Not sure if I should stop here in case that any option
-        // are not in the list
-        SqliteFunction::throwError("UNKNOWN-OPTION",
-                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
-                                    lItemJSONKey.getStringValue().str()).c_str());
+      if(theOptions->getPoolMaxSize() > 0 && theInUse >= theOptions->getPoolMaxSize())
+        SqliteFunction::throwError("POOL-EXHAUSTED",
+                                   SqliteFunction::getErrorMessage("POOL-EXHAUSTED"));
+      // Reserve the slot, the database is opened without holding the lock
+      ++theInUse;
     }
-    lIterKeys->close();
+
+    sqlite3* lDb;
+    SqliteOptions lOptions(*theOptions);
+    try
+    {
+      lDb = SqliteFunction::openDatabase(thePath, lOptions);
+    }
+    catch (...)
+    {
+      MutexLock lLock(theMutex);
+      --theInUse;
+      throw;
+    }
+
+    Connection* lConn = new Connection(lDb);
+    lConn->getStatementCache().setCapacity(lOptions.getStatementCacheSize());
+    lConn->getTimer().setTimeout(lOptions.getTimeout());
+    lConn->setPool(this);
+    MutexLock lLock(theMutex);
+    ++theCreated;
+    theCheckedOut.insert(lConn);
+    return lConn;
   }
 
-  int
-  SqliteOptions::getOptionsAsInt(){
-    int opts = 0;
-    if(theOpenCreate)
-      opts |= SQLITE_OPEN_CREATE;
-    if(theOpenReadOnly)
-      opts |= SQLITE_OPEN_READONLY;
+  void
+  ConnectionPool::checkin(Connection* aConn)
+  {
+    // An async job of the query may still be stepping on the connection
+    bool lReuse = !AsyncExecutor::hasJobs(aConn->getDb());
+
+    aConn->closeBlobs();
+    // Tracing is set up again by the query that wants it
+    aConn->getTrace().disable();
+    aConn->getTrace().reset();
+    // Never hand out a connection with a transaction left open
+    if(sqlite3_get_autocommit(aConn->getDb()) == 0 &&
+       sqlite3_exec(aConn->getDb(), "ROLLBACK TRANSACTION", NULL, NULL, NULL) != SQLITE_OK)
+      lReuse = false;
+    aConn->getTransactionMode();
+    // A result that is still being read keeps its statement busy
+    if(aConn->getStatementCache().getInUse() > 0)
+      lReuse = false;
+    // Functions registered by the query call back into it
+    if(!aConn->dropFunctions())
+      lReuse = false;
+
+    MutexLock lLock(theMutex);
+    sqlite3_int64 lNow = currentTimeMillis();
+    --theInUse;
+    theCheckedOut.erase(aConn);
+    if(lReuse && !theClosed &&
+       (theOptions->getPoolMaxSize() == 0 || theIdle.size() < theOptions->getPoolMaxSize()))
+      theIdle.push_front(std::pair<Connection*, sqlite3_int64>(aConn, lNow));
     else
-      opts |= SQLITE_OPEN_READWRITE;
-    if(theOpenNoMutex)
-      opts |= SQLITE_OPEN_NOMUTEX;
-    if(theOpenSharedCache)
-      opts |= SQLITE_OPEN_SHAREDCACHE;
-    return opts;
+      closeConnection(aConn);
+    collectIdle(lNow);
+  }
+
+  void
+  ConnectionPool::collectIdle(sqlite3_int64 aNow)
+  {
+    int lTimeout = theOptions->getPoolIdleTimeout();
+
+    if(lTimeout <= 0)
+      return;
+    while(!theIdle.empty() && theIdle.back().second + lTimeout <= aNow)
+    {
+      closeConnection(theIdle.back().first);
+      theIdle.pop_back();
+    }
+  }
+
+  bool
+  ConnectionPool::isValid(Connection* aConn)
+  {
+    return sqlite3_get_autocommit(aConn->getDb()) != 0 &&
+           sqlite3_exec(aConn->getDb(), "PRAGMA schema_version", NULL, NULL, NULL) == SQLITE_OK;
+  }
+
+  void
+  ConnectionPool::closeConnection(Connection* aConn)
+  {
+    aConn->close();
+    delete aConn;
+  }
+
+  unsigned int
+  ConnectionPool::getIdle()
+  {
+    MutexLock lLock(theMutex);
+    return theIdle.size();
+  }
+
+  unsigned int
+  ConnectionPool::getInUse()
+  {
+    MutexLock lLock(theMutex);
+    return theInUse;
+  }
+
+  unsigned int
+  ConnectionPool::getMaxSize() const
+  {
+    return theOptions->getPoolMaxSize();
+  }
+
+  sqlite3_int64
+  ConnectionPool::getCreated()
+  {
+    MutexLock lLock(theMutex);
+    return theCreated;
+  }
+
+  sqlite3_int64
+  ConnectionPool::getReused()
+  {
+    MutexLock lLock(theMutex);
+    return theReused;
+  }
+
+  /***********************
+   *       ConnMap       *
+   ***********************/
+
+  ConnMap::ConnMap(StmtMap* stmtMap)
+    : theConnections(HANDLE_CONNECTION)
+  {
+    sMap = stmtMap;
+  }
+
+  std::string
+  ConnMap::storeConn(sqlite3* sql)
+  {
+    return theConnections.add(new Connection(sql));
+  }
+
+  std::string
+  ConnMap::storeConnection(Connection* aConn)
+  {
+    return theConnections.add(aConn);
+  }
+
+  sqlite3*
+  ConnMap::getConn(const std::string& aKeyName)
+  {
+    Connection *lConn = getConnection(aKeyName);
+
+    if(lConn == NULL)
+      return NULL;
+
+    return lConn->getDb();
+  }
+
+  Connection*
+  ConnMap::getConnection(const std::string& aKeyName)
+  {
+    return theConnections.get(aKeyName);
+  }
+
+  // A blob handle is the handle of its connection followed by the handle the
+  // connection gave the blob, both parts are looked up in place
+  Connection*
+  ConnMap::getConnectionForBlob(const std::string& aBlobName)
+  {
+    if(aBlobName.size() != 2 * HandleTable<Connection>::HANDLE_LENGTH)
+      return NULL;
+    return theConnections.get(aBlobName.c_str(), HandleTable<Connection>::HANDLE_LENGTH);
+  }
+
+  std::string
+  ConnMap::storeBlob(const std::string& aConnName, Connection* aConn, Blob* aBlob)
+  {
+    return aConnName + aConn->addBlob(aBlob);
+  }
+
+  Blob*
+  ConnMap::getBlob(const std::string& aBlobName)
+  {
+    Connection* lConn = getConnectionForBlob(aBlobName);
+    if(lConn == NULL)
+      return NULL;
+    return lConn->getBlob(aBlobName.c_str() + HandleTable<Connection>::HANDLE_LENGTH,
+                          HandleTable<Connection>::HANDLE_LENGTH);
+  }
+
+  bool
+  ConnMap::closeBlob(const std::string& aBlobName)
+  {
+    Connection* lConn = getConnectionForBlob(aBlobName);
+    if(lConn == NULL)
+      return false;
+    return lConn->closeBlob(aBlobName.substr(HandleTable<Connection>::HANDLE_LENGTH));
+  }
+
+  void
+  ConnMap::releaseConnection(Connection* aConn)
+  {
+    // sqlite3_close() rolls back any transaction left open,
+    // pooled connections are handed back for the next query
+    if(aConn->getPool() != NULL)
+      aConn->getPool()->checkin(aConn);
+    else
+    {
+      aConn->close();
+      delete aConn;
+    }
+  }
+
+  bool
+  ConnMap::deleteConn(const std::string& aKeyName)
+  {
+    Connection* lConn = theConnections.remove(aKeyName);
+
+    if(lConn == NULL)
+      return false;
+      
+    if(sMap != NULL)
+      sMap->deleteAllForConn(lConn->getDb());
+    releaseConnection(lConn);
+    return true;
+  }
+
+  void
+  ConnMap::destroy() throw()
+  {
+    std::vector<Connection*> lConns;
+
+    if(sMap)
+      sMap->deleteAllForConn(NULL); // delete all prep-statements
+    theConnections.removeAll(lConns);
+    for(size_t i=0; i<lConns.size(); i++)
+      releaseConnection(lConns[i]);
+    delete this;
   }
   
+  ConnMap::~ConnMap(){ }
+
+/***********************
+ *       StmtMap       *
+***********************/
+
+  StmtMap::StmtMap()
+    : theStatements(HANDLE_STATEMENT)
+  {
+  }
+
   std::string
-  SqliteOptions::getOptionsAsString(){
-    std::string res;
-    bool somethingthere = false;
-    if(theOpenCreate)
+  StmtMap::storeStmt(sqlite3_stmt* stmt, Connection* aConn)
+  {
+    std::string lHandle = theStatements.add(new Entry(stmt, aConn));
+    MutexLock lLock(theMutex);
+    theConnStmts[sqlite3_db_handle(stmt)].insert(lHandle);
+    return lHandle;
+  }
+
+  sqlite3_stmt*
+  StmtMap::getStmt(const std::string& aKeyName)
+  {
+    Entry* lEntry = theStatements.get(aKeyName);
+    return (lEntry == NULL)?NULL:lEntry->theStmt;
+  }
+
+  Connection*
+  StmtMap::getConnection(const std::string& aKeyName)
+  {
+    Entry* lEntry = theStatements.get(aKeyName);
+    return (lEntry == NULL)?NULL:lEntry->theConnection;
+  }
+
+  unsigned int
+  StmtMap::getStatementCount(sqlite3* aDb)
+  {
+    MutexLock lLock(theMutex);
+    ConnStmts_t::const_iterator lConn = theConnStmts.find(aDb);
+    return (lConn == theConnStmts.end())?0:lConn->second.size();
+  }
+
+  bool
+  StmtMap::deleteStmt(const std::string& aKeyName)
+  {
+    Entry* lEntry = theStatements.remove(aKeyName);
+
+    if(lEntry == NULL)
+      return false;
+    sqlite3_stmt* lStmt = lEntry->theStmt;
+    delete lEntry;
+
+    MutexLock lLock(theMutex);
+    ConnStmts_t::iterator lConn = theConnStmts.find(sqlite3_db_handle(lStmt));
+    if(lConn != theConnStmts.end())
     {
-      res += "SQLITE_OPEN_CREATE";
-      somethingthere = true;
+      lConn->second.erase(aKeyName);
+      if(lConn->second.empty())
+        theConnStmts.erase(lConn);
     }
-    if(theOpenReadOnly)
+    theParamIndexes.erase(lStmt);
+    theMetadata.erase(lStmt);
+    sqlite3_finalize(lStmt);
+    return true;
+  }
+
+  int
+  StmtMap::getParameterIndex(sqlite3_stmt* aStmt, const std::string& aName)
+  {
+    // Names are resolved once per statement, later bindings reuse the position
+    MutexLock lLock(theMutex);
+    ParamIndex_t& lIndexes = theParamIndexes[aStmt];
+    ParamIndex_t::iterator lIter = lIndexes.find(aName);
+    if(lIter != lIndexes.end())
+      return lIter->second;
+
+    int lIndex = SqliteFunction::getParameterIndex(aStmt, aName);
+    lIndexes[aName] = lIndex;
+    return lIndex;
+  }
+
+  bool
+  StmtMap::getMetadata(sqlite3_stmt* aStmt, zorba::Item& aMetadata)
+  {
+    MutexLock lLock(theMutex);
+    Metadata_t::iterator lIter = theMetadata.find(aStmt);
+    if(lIter == theMetadata.end() ||
+       lIter->second.first != sqlite3_stmt_status(aStmt, SQLITE_STMTSTATUS_REPREPARE, 0))
+      return false;
+    aMetadata = lIter->second.second;
+    return true;
+  }
+
+  void
+  StmtMap::setMetadata(sqlite3_stmt* aStmt, const zorba::Item& aMetadata)
+  {
+    MutexLock lLock(theMutex);
+    theMetadata[aStmt] = std::pair<int, zorba::Item>(
+      sqlite3_stmt_status(aStmt, SQLITE_STMTSTATUS_REPREPARE, 0), aMetadata);
+  }
+
+  void
+  StmtMap::destroy() throw()
+  {
+    deleteAllForConn(NULL);
+    delete this;
+  }
+  
+  void
+  StmtMap::deleteAllForConn(sqlite3* c)
+  {
+    MutexLock lLock(theMutex);
+    if(c == NULL)
     {
-      if(somethingthere)
+      std::vector<Entry*> lEntries;
+      theStatements.removeAll(lEntries);
+      for(size_t i=0; i<lEntries.size(); i++)
       {
-        res += " | ";
+        sqlite3_finalize(lEntries[i]->theStmt);
+        delete lEntries[i];
       }
-      res += "SQLITE_OPEN_READONLY";
-      somethingthere = true;
+      theConnStmts.clear();
+      theParamIndexes.clear();
+      theMetadata.clear();
+      return;
     }
-    else
+
+    // Only the statements of the connection are visited
+    ConnStmts_t::iterator lConn = theConnStmts.find(c);
+    if(lConn == theConnStmts.end())
+      return;
+    std::set<std::string> lHandles;
+    lHandles.swap(lConn->second);
+    theConnStmts.erase(lConn);
+    for(std::set<std::string>::iterator lIter = lHandles.begin();
+        lIter != lHandles.end(); ++lIter)
     {
-      if(somethingthere)
-      {
-        res += " | ";
-      }
-      res += "SQLITE_OPEN_READWRITE";
-      somethingthere = true;
+      Entry* lEntry = theStatements.remove(*lIter);
+      if(lEntry == NULL)
+        continue;
+      sqlite3_stmt* lStmt = lEntry->theStmt;
+      delete lEntry;
+      theParamIndexes.erase(lStmt);
+      theMetadata.erase(lStmt);
+      sqlite3_finalize(lStmt);
     }
-    if(theOpenNoMutex)
+  }
+
+  StmtMap::~StmtMap(){ }
+
+/*******************************************************************************
+ *                              SqliteFunction                                 *
+ *******************************************************************************/
+  SqliteFunction::SqliteFunction(const SqliteModule* aModule)
+    : theModule(aModule) {}
+
+  SqliteFunction::~SqliteFunction(){}
+
+  ConnMap*
+  SqliteFunction::getConnectionMap(const zorba::DynamicContext* aDctx){
+    DynamicContext* lDynCtx = const_cast<DynamicContext*>(aDctx);
+    ConnMap* lConnMap;
+    StmtMap* lStmtMap;
+    if(!(lConnMap = dynamic_cast<ConnMap*>(lDynCtx->getExternalFunctionParameter("sqliteConnMap"))))
     {
-      if(somethingthere)
-      {
-        res += " | ";
-      }
-      res += "SQLITE_OPEN_NOMUTEX";
-      somethingthere = true;
+      lStmtMap = getStatementMap(lDynCtx);
+      lConnMap = new ConnMap(lStmtMap);
+      lDynCtx->addExternalFunctionParameter("sqliteConnMap", lConnMap);     
     }
-    if(theOpenSharedCache)
+    return lConnMap;
+  }
+
+  AsyncMap*
+  SqliteFunction::getAsyncMap(const zorba::DynamicContext* aDctx){
+    DynamicContext* lDynCtx = const_cast<DynamicContext*>(aDctx);
+    AsyncMap* lAsyncMap;
+    if(!(lAsyncMap = dynamic_cast<AsyncMap*>(lDynCtx->getExternalFunctionParameter("sqliteAsyncMap"))))
     {
-      if(somethingthere)
-      {
-        res += " | ";
-      }
-      res += "SQLITE_OPEN_SHAREDCACHE";
+      lAsyncMap = new AsyncMap();
+      lDynCtx->addExternalFunctionParameter("sqliteAsyncMap", lAsyncMap);
+    }
+    return lAsyncMap;
+  }
+
+  void
+  SqliteFunction::awaitJob(const zorba::DynamicContext* aDctx,
+                           const std::string& aHandle,
+                           std::vector<zorba::Item>& aRows){
+    AsyncMap* lAsyncMap = getAsyncMap(aDctx);
+    AsyncJob* lJob = lAsyncMap->getJob(aHandle);
+    if(lJob == NULL)
+      throwError("INVALID-ASYNC-HANDLE", getErrorMessage("INVALID-ASYNC-HANDLE"));
+
+    AsyncExecutor* lExecutor = AsyncExecutor::getInstance();
+    lExecutor->wait(lJob);
+    lAsyncMap->removeJob(aHandle);
+
+    int lRc = lJob->theRc;
+    std::string lError = lJob->theError;
+    if(lRc == SQLITE_DONE)
+    {
+      ItemFactory* lFactory = SqliteModule::getItemFactory();
+      std::vector<Item> lKeys;
+      for(size_t i=0; i<lJob->theColumns.size(); i++)
+        lKeys.push_back(lFactory->createString(lJob->theColumns[i]));
+      for(AsyncJob::Rows_t::const_iterator lRow = lJob->theRows.begin();
+          lRow != lJob->theRows.end(); ++lRow)
+      {
+        std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+        for(size_t i=0; i<lKeys.size(); i++)
+          lElements.push_back(std::pair<Item, Item>(lKeys[i],
+            RowBuffer::createItem(lFactory, (*lRow)[i])));
+        aRows.push_back(lFactory->createJSONObject(lElements));
+      }
+    }
+    lExecutor->release(lJob);
+    if(lRc != SQLITE_DONE)
+      throwStepError(lRc, lError, 0);
+  }
+
+  StmtMap*
+  SqliteFunction::getStatementMap(const zorba::DynamicContext* aDctx){
+    DynamicContext* lDynCtx = const_cast<DynamicContext*>(aDctx);
+    StmtMap* lStmtMap;
+    if(!(lStmtMap = dynamic_cast<StmtMap*>(lDynCtx->getExternalFunctionParameter("sqliteStmtMap"))))
+    {
+      lStmtMap = new StmtMap();
+      lDynCtx->addExternalFunctionParameter("sqliteStmtMap", lStmtMap);     
+    }
+    return lStmtMap;
+  }
+
+  Connection*
+  SqliteFunction::getConnection(const zorba::DynamicContext* aDctx,
+                                const std::string& aUUID){
+    Connection* lConn = getConnectionMap(aDctx)->getConnection(aUUID);
+    if(lConn == NULL)
+      throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
+    return lConn;
+  }
+
+  void
+  SqliteFunction::executeSql(sqlite3* aDb, const char* aSql){
+    checkForError(sqlite3_exec(aDb, aSql, NULL, NULL, NULL), 0, aDb);
+  }
+
+  sqlite3*
+  SqliteFunction::openDatabase(std::string aDbName, SqliteOptions& aOptions){
+    sqlite3 *lSqldb = NULL;
+    int lRc;
+
+    if(aDbName == "")
+      aDbName = std::string(":memory:");
+
+#ifndef SQLITE_WITH_FILE_ACCESS
+    if (aDbName != ":memory:") {
+      throwError("COMPILED-WITHOUT-DISK-ACCESS",
+                 getErrorMessage("COMPILED-WITHOUT-DISK-ACCESS"));
+    }
+#endif /* not SQLITE_WITH_FILE_ACCESS */
+    lRc = sqlite3_open_v2(aDbName.c_str(), &lSqldb, aOptions.getOptionsAsInt(), NULL);
+    if(lRc != SQLITE_OK)
+    {
+      std::string lErr = (lSqldb != NULL)?sqlite3_errmsg(lSqldb):sqlite3_errstr(lRc);
+      sqlite3_close(lSqldb);
+      if(lRc == SQLITE_CANTOPEN)
+        throwError("CANT-OPEN-DB", getErrorMessage("CANT-OPEN-DB"));
+      else
+        throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
+    }
+    try
+    {
+      aOptions.applyPragmas(lSqldb);
+    }
+    catch (...)
+    {
+      sqlite3_close(lSqldb);
+      throw;
+    }
+    return lSqldb;
+  }
+
+  sqlite3_stmt* 
+  SqliteFunction::createPreparedStatement(const zorba::DynamicContext* aDctx,
+                                          std::string aUUID, std::string aQry){
+    sqlite3 *lDb;
+    ConnMap* lConnMap = SqliteFunction::getConnectionMap(aDctx);
+
+    lDb = lConnMap->getConn(aUUID);
+    if(lDb == NULL){
+      // throw error, ID not recognized
+      throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
+    }
+
+    return prepareStatement(lDb, aQry);
+  }
+
+  sqlite3_stmt*
+  SqliteFunction::prepareStatement(sqlite3* aDb, const std::string& aQry){
+    const char *lTail;
+    return prepareStatement(aDb, aQry.c_str(), aQry.size(), &lTail);
+  }
+
+  sqlite3_stmt*
+  SqliteFunction::prepareStatement(sqlite3* aDb, const char* aSql, int aLength,
+                                   const char** aTail){
+    sqlite3 *lDb = aDb;
+    sqlite3_stmt *lPstmt;
+    int lRc;
+
+    lRc = sqlite3_prepare_v2(lDb, aSql, aLength, &lPstmt, aTail);
+    if(lRc != 0 && lPstmt != NULL){
+      sqlite3_finalize(lPstmt);
+    }
+    if(lRc == SQLITE_ERROR) {
+      std::string lErr = getErrorMessage("INVALID-SQL-STATEMENT");
+      lErr += "; ";
+      lErr += sqlite3_errmsg(lDb);
+      throwError("INVALID-SQL-STATEMENT", lErr.c_str());
+    } else
+      checkForError(lRc, 0, lDb);
+
+    return lPstmt;
+  }
+
+  void
+  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
+    std::string aUUID, 
+    int aPos, bool aVal)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    int lRc;
+    
+    // Get the prepared statement and then set the value
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    lRc = sqlite3_bind_int(lPstmt, aPos, (aVal==true)?1:0);
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+  }
+
+  void
+  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
+    std::string aUUID, 
+    int aPos, 
+    int aVal)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    int lRc;
+    
+    // Get the prepared statement and then set the value
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    lRc = sqlite3_bind_int(lPstmt, aPos, aVal);
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+  }
+
+  void
+  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
+    std::string aUUID,
+    int aPos,
+    double aVal)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);\
+    int lRc;
+    
+    // Get the prepared statement and then set the value
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    lRc = sqlite3_bind_double(lPstmt, aPos, aVal);
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+  }
+
+  void
+  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
+    std::string aUUID,
+    int aPos,
+    std::string aVal)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    int lRc;
+    
+    // Get the prepared statement and then set the value
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    lRc = sqlite3_bind_text(lPstmt, aPos, aVal.c_str(), aVal.size(), SQLITE_TRANSIENT);
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+  }
+
+  void
+  SqliteFunction::setValueToStatement(const zorba::DynamicContext* aDctx,
+    std::string aUUID,
+    int aPos)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    int lRc;
+    
+    // Get the prepared statement and then set the value
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    lRc = sqlite3_bind_null(lPstmt, aPos);
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(lPstmt));
+  }
+
+  void
+  SqliteFunction::clearValues(const zorba::DynamicContext* aDctx,
+    std::string aUUID)
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    	
+    // get the prepared statement if exists
+    lPstmt = stmtMap->getStmt(aUUID);
+    if(lPstmt == NULL){
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+    sqlite3_clear_bindings(lPstmt);
+  }
+
+  void
+  SqliteFunction::getItemValue(const zorba::Item& aItem, RowBuffer::Value& aValue)
+  {
+    if(aItem.isNull())
+    {
+      aValue.theType = SQLITE_NULL;
+      return;
+    }
+    if(aItem.isJSONItem() || !aItem.isAtomic())
+      throwError("INVALID-VALUE", getErrorMessage("INVALID-VALUE"));
+
+    switch(aItem.getTypeCode()){
+    case store::JS_NULL:
+      aValue.theType = SQLITE_NULL;
+      break;
+    case store::XS_BOOLEAN:
+      aValue.theType = SQLITE_INTEGER;
+      aValue.theInteger = aItem.getBooleanValue()?1:0;
+      break;
+    case store::XS_BYTE:
+    case store::XS_INT:
+      aValue.theType = SQLITE_INTEGER;
+      aValue.theInteger = aItem.getIntValue();
+      break;
+    case store::XS_LONG:
+      aValue.theType = SQLITE_INTEGER;
+      aValue.theInteger = aItem.getLongValue();
+      break;
+    case store::XS_SHORT:
+    case store::XS_INTEGER:
+    case store::XS_NON_NEGATIVE_INTEGER:
+    case store::XS_NON_POSITIVE_INTEGER:
+    case store::XS_POSITIVE_INTEGER:
+    case store::XS_NEGATIVE_INTEGER:
+    case store::XS_UNSIGNED_BYTE:
+    case store::XS_UNSIGNED_SHORT:
+    case store::XS_UNSIGNED_INT:
+    case store::XS_UNSIGNED_LONG:
+      {
+        // Unbounded types, SQLite integers have 64 bits
+        std::string lStr = aItem.getStringValue().str();
+        char* lEnd;
+        errno = 0;
+        long long lValue = strtoll(lStr.c_str(), &lEnd, 10);
+        if(errno == ERANGE || lStr.empty() || *lEnd != '\0')
+          throwError("INVALID-VALUE", (std::string(getErrorMessage("INVALID-VALUE")) +
+                                       " - " + lStr).c_str());
+        aValue.theType = SQLITE_INTEGER;
+        aValue.theInteger = lValue;
+      }
+      break;
+    case store::XS_FLOAT:
+    case store::XS_DOUBLE:
+      aValue.theType = SQLITE_FLOAT;
+      aValue.theDouble = aItem.getDoubleValue();
+      break;
+    case store::XS_DECIMAL:
+      {
+        // A double keeps DBL_DIG significant digits, longer values are
+        // passed as text so they aren't rounded
+        std::string lStr = aItem.getStringValue().str();
+        std::string lDigits;
+        for(size_t i=0; i<lStr.size(); i++)
+        {
+          if(isdigit((unsigned char)lStr[i]) && (lStr[i] != '0' || !lDigits.empty()))
+            lDigits += lStr[i];
+        }
+        lDigits.erase(lDigits.find_last_not_of('0') + 1);
+        double lValue = strtod(lStr.c_str(), NULL);
+        if(lDigits.size() <= DBL_DIG && lValue <= DBL_MAX && lValue >= -DBL_MAX)
+        {
+          aValue.theType = SQLITE_FLOAT;
+          aValue.theDouble = lValue;
+        }
+        else
+        {
+          aValue.theType = SQLITE_TEXT;
+          aValue.theBytes = lStr;
+        }
+      }
+      break;
+    case store::XS_BASE64BINARY:
+      {
+        zorba::Item lItem(aItem);
+        std::string lData;
+        size_t lSize = 0;
+        const char* lValue;
+        if(lItem.isStreamable())
+        {
+          std::stringstream lBuffer;
+          lBuffer << lItem.getStream().rdbuf();
+          lData = lBuffer.str();
+          lValue = lData.data();
+          lSize = lData.size();
+        }
+        else
+          lValue = lItem.getBase64BinaryValue(lSize);
+        aValue.theType = SQLITE_BLOB;
+        if(lItem.isEncoded() && lSize > 0)
+        {
+          std::vector<char> lDecoded(base64::decoded_size(lSize));
+          lSize = base64::decode(lValue, lSize, &lDecoded[0]);
+          aValue.theBytes.assign(&lDecoded[0], lSize);
+        }
+        else
+          aValue.theBytes.assign(lValue, lSize);
+      }
+      break;
+    default:
+      {
+        String lStr = aItem.getStringValue();
+        aValue.theType = SQLITE_TEXT;
+        aValue.theBytes.assign(lStr.c_str(), lStr.size());
+      }
+    }
+  }
+
+  void
+  SqliteFunction::bindItem(sqlite3_stmt* aStmt, int aPos, const zorba::Item& aItem)
+  {
+    RowBuffer::Value lValue;
+    int lRc;
+
+    getItemValue(aItem, lValue);
+    switch(lValue.theType){
+    case SQLITE_NULL:
+      lRc = sqlite3_bind_null(aStmt, aPos);
+      break;
+    case SQLITE_INTEGER:
+      lRc = sqlite3_bind_int64(aStmt, aPos, lValue.theInteger);
+      break;
+    case SQLITE_FLOAT:
+      lRc = sqlite3_bind_double(aStmt, aPos, lValue.theDouble);
+      break;
+    case SQLITE_BLOB:
+      lRc = sqlite3_bind_blob(aStmt, aPos, lValue.theBytes.data(),
+                              (int)lValue.theBytes.size(), SQLITE_TRANSIENT);
+      break;
+    default:
+      lRc = sqlite3_bind_text(aStmt, aPos, lValue.theBytes.data(),
+                              (int)lValue.theBytes.size(), SQLITE_TRANSIENT);
+    }
+    if(lRc == SQLITE_RANGE)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 getErrorMessage("INVALID-PLACEHOLDER-POSITION"));
+    else
+      checkForError(lRc, 0, sqlite3_db_handle(aStmt));
+  }
+
+  void
+  SqliteFunction::bindParameters(sqlite3_stmt* aStmt, const zorba::Item& aParams, StmtMap* aMap)
+  {
+    Item lKey;
+
+    if(aParams.isJSONItem() &&
+       aParams.getJSONItemKind() == store::StoreConsts::jsonArray)
+    {
+      // Arrays are bound by position
+      uint64_t lSize = aParams.getArraySize();
+      for(uint64_t i=1; i<=lSize; i++)
+        bindItem(aStmt, (int)i, aParams.getArrayValue((uint32_t)i));
+    }
+    else if(aParams.isJSONItem() &&
+            aParams.getJSONItemKind() == store::StoreConsts::jsonObject)
+    {
+      // Objects are bound by parameter name
+      Iterator_t lIterKeys = aParams.getObjectKeys();
+      lIterKeys->open();
+      while(lIterKeys->next(lKey))
+      {
+        String lName = lKey.getStringValue();
+        // Statements that aren't registered don't cache the positions
+        bindItem(aStmt,
+                 (aMap == NULL)?getParameterIndex(aStmt, lName.str()):
+                                aMap->getParameterIndex(aStmt, lName.str()),
+                 aParams.getObjectValue(lName));
+      }
+      lIterKeys->close();
+    }
+    else
+      // A single value binds the first placeholder
+      bindItem(aStmt, 1, aParams);
+  }
+
+  int
+  SqliteFunction::getParameterIndex(sqlite3_stmt* aStmt, const std::string& aName)
+  {
+    int lIndex;
+
+    if(!aName.empty() && (aName[0] == ':' || aName[0] == '@' || aName[0] == '$'))
+      lIndex = sqlite3_bind_parameter_index(aStmt, aName.c_str());
+    else
+    {
+      // Accept the bare name for any of the SQLite parameter prefixes
+      lIndex = sqlite3_bind_parameter_index(aStmt, (":" + aName).c_str());
+      if(lIndex == 0)
+        lIndex = sqlite3_bind_parameter_index(aStmt, ("@" + aName).c_str());
+      if(lIndex == 0)
+        lIndex = sqlite3_bind_parameter_index(aStmt, ("$" + aName).c_str());
+    }
+    if(lIndex == 0)
+      throwError("INVALID-PLACEHOLDER-POSITION",
+                 (std::string(getErrorMessage("INVALID-PLACEHOLDER-POSITION")) + " - " +
+                  aName).c_str());
+    return lIndex;
+  }
+
+  String 
+  SqliteFunction::getURI() const
+  {
+    return theModule->getURI();
+  }
+
+  void
+  SqliteFunction::throwError(
+        const char* aLocalName,
+        const char* aErrorMessage)
+  {
+    String errNS(SqliteModule::getModuleURI());
+    Item errQName = SqliteModule::getItemFactory()->createQName(
+        errNS, aLocalName);
+    throw USER_EXCEPTION(errQName, aErrorMessage);
+  }
+
+  void
+  SqliteFunction::checkForError(
+        int aErrNo,
+        const char* aLocalName,
+        sqlite3 *sql)
+  {
+    if (aErrNo != SQLITE_OK)
+    {
+      if (!aLocalName)
+      {
+        throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errmsg(sql));
+      }
+      else
+      {
+        throwError(aLocalName, sqlite3_errmsg(sql));
+      }
+    }
+  }
+
+  void
+  SqliteFunction::throwStepError(int aRc, const std::string& aError,
+                                 sqlite3_int64 aDeadline)
+  {
+    if((aRc & 0xff) == SQLITE_INTERRUPT)
+    {
+      // The progress handler and sqlite3_interrupt() end the statement the
+      // same way
+      if(aDeadline != 0 && currentTimeMillis() >= aDeadline)
+        throwError("QUERY-TIMEOUT", getErrorMessage("QUERY-TIMEOUT"));
+      throwError("QUERY-INTERRUPTED", getErrorMessage("QUERY-INTERRUPTED"));
+    }
+    throwError("INTERNAL-SQLITE-PROBLEM", aError.c_str());
+  }
+
+  QueryTimer*
+  SqliteFunction::getTimer(const zorba::DynamicContext* aDctx, const std::string& aStmtUUID)
+  {
+    Connection* lConn = getStatementMap(aDctx)->getConnection(aStmtUUID);
+    return (lConn == NULL)?NULL:&lConn->getTimer();
+  }
+
+  QueryOptions
+  SqliteFunction::getQueryOptions(const Arguments_t& aArgs, int aIndex,
+                                  const Connection* aConn)
+  {
+    QueryOptions lOptions;
+    if((int)aArgs.size() > aIndex)
+    {
+      Item lItemOpts = getOneItem(aArgs, aIndex);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
+    if(aConn != NULL && aConn->hasFunctions())
+      lOptions.disablePrefetch();
+    return lOptions;
+  }
+
+  Blob*
+  SqliteFunction::getBlob(const zorba::DynamicContext* aDctx,
+                          const std::string& aUUID)
+  {
+    Blob* lBlob = getConnectionMap(aDctx)->getBlob(aUUID);
+    if(lBlob == NULL)
+      throwError("INVALID-BLOB", getErrorMessage("INVALID-BLOB"));
+    return lBlob;
+  }
+
+  void
+  SqliteFunction::checkBlobRange(Blob* aBlob, sqlite3_int64 aOffset, sqlite3_int64 aLength)
+  {
+    // Incremental I/O can't change the size of a blob
+    if(aOffset < 0 || aLength < 0 || aOffset + aLength > aBlob->getSize())
+      throwError("BLOB-OUT-OF-RANGE", getErrorMessage("BLOB-OUT-OF-RANGE"));
+  }
+
+  zorba::Item
+  SqliteFunction::getOneItem(const Arguments_t& aArgs, int aIndex)
+  {
+    Item lItem;
+    Iterator_t args_iter = aArgs[aIndex]->getIterator();
+    args_iter->open();
+    args_iter->next(lItem);
+    args_iter->close();
+
+    return lItem;
+  }
+
+  int
+  SqliteFunction::strToInt(std::string str){
+    int iInt = 0;
+    sscanf(str.c_str(), "%d", &iInt);
+    return iInt;
+  }
+
+  sqlite3_int64
+  SqliteFunction::strToLong(std::string str){
+    long long lLong = 0;
+    sscanf(str.c_str(), "%lld", &lLong);
+    return lLong;
+  }
+
+  double
+  SqliteFunction::strToDouble(std::string str){
+    double dDbl = 0;
+    sscanf(str.c_str(), "%lf", &dDbl);
+    return dDbl;
+  }
+
+  const char *
+  SqliteFunction::getErrorMessage(std::string error){
+    if(error == "CANT-OPEN-DB")
+    {
+      return "Database file does not exist or it is not possible to open it";
+    } 
+    else if(error == "INVALID-SQLITE-OBJECT")
+    {
+      return "Connection ID passed is not valid";
+    }
+    else if(error == "INVALID-SQL-STATEMENT")
+    {
+      return "Statement passed is not a valid SQL statement";
+    }
+    else if(error == "INVALID-PREPARED-STATEMENT")
+    {
+      return "Prepared statement passed is not valid";
+    }
+    else if(error == "INVALID-PLACEHOLDER-POSITION")
+    {
+      return "Parameter position passed is not valid";
+    }
+    else if(error == "INVALID-VALUE")
+    {
+      return "Parameter passed is not a valid number";
+    }
+    else if(error == "UNKNOWN-OPTION")
+    {
+      return "Parameter passed is not a valid value";
+    }
+    else if(error == "INVALID-TRANSACTION-MODE")
+    {
+      return "Transaction mode must be one of deferred, immediate or exclusive";
+    }
+    else if(error == "POOL-EXHAUSTED")
+    {
+      return "All connections of the pool are in use";
+    }
+    else if(error == "POOL-MISMATCH")
+    {
+      return "Connection pool already exists for a different database";
+    }
+    else if(error == "UNKNOWN-POOL")
+    {
+      return "Connection pool name passed is not valid";
+    }
+    else if(error == "INVALID-BLOB")
+    {
+      return "Blob handle passed is not valid";
+    }
+    else if(error == "BLOB-OUT-OF-RANGE")
+    {
+      return "Offset and length passed are outside of the blob";
+    }
+    else if(error == "INVALID-ASYNC-HANDLE")
+    {
+      return "Async query handle passed is not valid";
+    }
+    else if(error == "SHARD-MISMATCH")
+    {
+      return "Shards passed don't return the same columns";
+    }
+    else if(error == "QUERY-TIMEOUT")
+    {
+      return "Query didn't finish within its timeout";
+    }
+    else if(error == "QUERY-INTERRUPTED")
+    {
+      return "Query was interrupted";
+    }
+#ifndef SQLITE_WITH_FILE_ACCESS
+    else if(error == "COMPILED-WITHOUT-DISK-ACCESS")
+    {
+      return "Only in-memory databases are allowed (Module built without filesystem access)";
+    }
+#endif /* not SQLITE_WITH_FILE_ACCESS */
+#ifndef ZORBA_SQLITE_HAVE_METADATA
+    else if(error == "UNAVAILABLE-METADATA")
+    {
+      return "Metadata not found (SQLite built without SQLITE_ENABLE_COLUMN_METADATA)";
+    }
+#endif /* not ZORBA_SQLITE_HAVE_METADATA */
+#ifndef ZORBA_SQLITE_HAVE_SERIALIZE
+    else if(error == "UNAVAILABLE-SERIALIZE")
+    {
+      return "Database images not supported (SQLite built with SQLITE_OMIT_DESERIALIZE)";
+    }
+#endif /* not ZORBA_SQLITE_HAVE_SERIALIZE */
+    else if(error == "INTERNAL-SQLITE-PROBLEM")
+    {
+      return "Internal error ocurred";
+    }
+    return "";
+  }
+
+  /********************
+   *  Sqlite Options  *
+   ********************/
+
+  static const char* const theJournalModes[] =
+    { "delete", "truncate", "persist", "memory", "wal", "off", NULL };
+  static const char* const theSynchronousModes[] =
+    { "off", "normal", "full", "extra", NULL };
+  static const char* const theTempStores[] =
+    { "default", "file", "memory", NULL };
+  static const char* const theLockingModes[] =
+    { "normal", "exclusive", NULL };
+
+  SqliteOptions::SqliteOptions()
+    : theOpenReadOnly(false),
+      theOpenCreate(true),
+      theOpenNoMutex(false),
+      theOpenSharedCache(false),
+      theStatementCacheSize(StatementCache::DEFAULT_CAPACITY),
+      theBusyTimeout(-1),
+      theTimeout(0),
+      thePoolMaxSize(ConnectionPool::DEFAULT_MAX_SIZE),
+      thePoolIdleTimeout(ConnectionPool::DEFAULT_IDLE_TIMEOUT) {}
+
+  void
+  SqliteOptions::setValues(sqlite3* aSqlite)
+  {
+    // Read back the values that are in effect on the connection
+    theJournalMode = getPragma(aSqlite, "journal_mode");
+    theSynchronous = getPragma(aSqlite, "synchronous");
+    if(theSynchronous.size() == 1 && theSynchronous[0] >= '0' && theSynchronous[0] <= '3')
+      theSynchronous = theSynchronousModes[theSynchronous[0] - '0'];
+    theCacheSize = getPragma(aSqlite, "cache_size");
+    theMmapSize = getPragma(aSqlite, "mmap_size");
+    if(theMmapSize.empty())
+      theMmapSize = "0"; // SQLite built without memory-mapped I/O
+    theTempStore = getPragma(aSqlite, "temp_store");
+    if(theTempStore.size() == 1 && theTempStore[0] >= '0' && theTempStore[0] <= '2')
+      theTempStore = theTempStores[theTempStore[0] - '0'];
+    thePageSize = getPragma(aSqlite, "page_size");
+    theLockingMode = getPragma(aSqlite, "locking_mode");
+    theBusyTimeout = SqliteFunction::strToInt(getPragma(aSqlite, "busy_timeout"));
+  }
+
+  void
+  SqliteOptions::applyPragmas(sqlite3* aSqlite)
+  {
+    // The page size only has an effect before the database is created and
+    // has to be set before switching to WAL
+    if(!thePageSize.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA page_size = " + thePageSize).c_str());
+    if(!theLockingMode.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA locking_mode = " + theLockingMode).c_str());
+    if(!theJournalMode.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA journal_mode = " + theJournalMode).c_str());
+    if(!theSynchronous.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA synchronous = " + theSynchronous).c_str());
+    if(!theCacheSize.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA cache_size = " + theCacheSize).c_str());
+    if(!theMmapSize.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA mmap_size = " + theMmapSize).c_str());
+    if(!theTempStore.empty())
+      SqliteFunction::executeSql(aSqlite, ("PRAGMA temp_store = " + theTempStore).c_str());
+    if(theBusyTimeout >= 0)
+      SqliteFunction::checkForError(sqlite3_busy_timeout(aSqlite, theBusyTimeout), 0, aSqlite);
+  }
+
+  void
+  SqliteOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      Item lOptionValue;
+      lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+
+      if (lItemJSONKey.getStringValue() == "open-read-only")
+      {
+        theOpenReadOnly = lOptionValue.getBooleanValue() == true;
+      }
+      else if (lItemJSONKey.getStringValue() == "open-create")
+      {
+        theOpenCreate = lOptionValue.getBooleanValue();
+      }
+      else if (lItemJSONKey.getStringValue() == "open-no-mutex")
+      {
+        theOpenNoMutex = lOptionValue.getBooleanValue();
+      }
+      else if(lItemJSONKey.getStringValue() == "open-shared-cache")
+      {
+        theOpenSharedCache = lOptionValue.getBooleanValue();
+      }
+      else if(lItemJSONKey.getStringValue() == "statement-cache-size")
+      {
+        theStatementCacheSize = SqliteFunction::strToInt(
+          getIntegerValue(lItemJSONKey, lOptionValue, false));
+      }
+      else if(lItemJSONKey.getStringValue() == "journal-mode")
+      {
+        theJournalMode = getEnumValue(lItemJSONKey, lOptionValue, theJournalModes);
+      }
+      else if(lItemJSONKey.getStringValue() == "synchronous")
+      {
+        theSynchronous = getEnumValue(lItemJSONKey, lOptionValue, theSynchronousModes);
+      }
+      else if(lItemJSONKey.getStringValue() == "cache-size")
+      {
+        // Negative values are a size in KiB instead of a number of pages
+        theCacheSize = getIntegerValue(lItemJSONKey, lOptionValue, true);
+      }
+      else if(lItemJSONKey.getStringValue() == "mmap-size")
+      {
+        theMmapSize = getIntegerValue(lItemJSONKey, lOptionValue, false);
+      }
+      else if(lItemJSONKey.getStringValue() == "temp-store")
+      {
+        theTempStore = getEnumValue(lItemJSONKey, lOptionValue, theTempStores);
+      }
+      else if(lItemJSONKey.getStringValue() == "page-size")
+      {
+        thePageSize = getIntegerValue(lItemJSONKey, lOptionValue, false);
+      }
+      else if(lItemJSONKey.getStringValue() == "locking-mode")
+      {
+        theLockingMode = getEnumValue(lItemJSONKey, lOptionValue, theLockingModes);
+      }
+      else if(lItemJSONKey.getStringValue() == "busy-timeout")
+      {
+        theBusyTimeout = SqliteFunction::strToInt(
+          getIntegerValue(lItemJSONKey, lOptionValue, false));
+      }
+      else if(lItemJSONKey.getStringValue() == "timeout-ms")
+      {
+        theTimeout = SqliteFunction::strToInt(
+          getIntegerValue(lItemJSONKey, lOptionValue, false));
+      }
+      else if(lItemJSONKey.getStringValue() == "pool-max-size")
+      {
+        thePoolMaxSize = SqliteFunction::strToInt(
+          getIntegerValue(lItemJSONKey, lOptionValue, false));
+      }
+      else if(lItemJSONKey.getStringValue() == "pool-idle-timeout")
+      {
+        thePoolIdleTimeout = SqliteFunction::strToInt(
+          getIntegerValue(lItemJSONKey, lOptionValue, false));
+      } else
+        // Not sure if I should stop here in case that any option
+        // are not in the list
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lItemJSONKey.getStringValue().str()).c_str());
+    }
+    lIterKeys->close();
+  }
+
+  std::string
+  SqliteOptions::getEnumValue(const Item& aKey,
+                              const Item& aValue,
+                              const char* const* aAllowed)
+  {
+    std::string lValue = aValue.getStringValue().str();
+    for(std::string::iterator lIter = lValue.begin(); lIter != lValue.end(); ++lIter)
+      *lIter = tolower(*lIter);
+
+    // Only known values end up in the PRAGMA commands
+    for(; *aAllowed != NULL; ++aAllowed)
+    {
+      if(lValue == *aAllowed)
+        return lValue;
+    }
+    SqliteFunction::throwError("UNKNOWN-OPTION",
+                               (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                aKey.getStringValue().str() + ": " + lValue).c_str());
+    return lValue;
+  }
+
+  std::string
+  SqliteOptions::getIntegerValue(const Item& aKey,
+                                 const Item& aValue,
+                                 bool aAllowNegative)
+  {
+    std::string lValue = aValue.getStringValue().str();
+    char* lEnd;
+    errno = 0;
+    sqlite3_int64 lInt = strtoll(lValue.c_str(), &lEnd, 10);
+
+    if(lValue.empty() || *lEnd != '\0' || errno == ERANGE ||
+       (lInt < 0 && !aAllowNegative))
+      SqliteFunction::throwError("UNKNOWN-OPTION",
+                                 (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                  aKey.getStringValue().str() + ": " + lValue).c_str());
+    std::stringstream lStream;
+    lStream << lInt;
+    return lStream.str();
+  }
+
+  std::string
+  SqliteOptions::getPragma(sqlite3* aSqlite, const char* aPragma)
+  {
+    sqlite3_stmt* lStmt = SqliteFunction::prepareStatement(aSqlite,
+      std::string("PRAGMA ") + aPragma);
+    std::string lValue;
+
+    if(lStmt == NULL)
+      return lValue;
+    if(sqlite3_step(lStmt) == SQLITE_ROW && sqlite3_column_text(lStmt, 0) != NULL)
+      lValue = (const char*)sqlite3_column_text(lStmt, 0);
+    sqlite3_finalize(lStmt);
+    return lValue;
+  }
+
+  int
+  SqliteOptions::getOptionsAsInt(){
+    int opts = 0;
+    if(theOpenCreate)
+      opts |= SQLITE_OPEN_CREATE;
+    if(theOpenReadOnly)
+      opts |= SQLITE_OPEN_READONLY;
+    else
+      opts |= SQLITE_OPEN_READWRITE;
+    // Connections are serialized by SQLite unless asked otherwise, whatever
+    // threading mode the library was built with
+    if(theOpenNoMutex)
+      opts |= SQLITE_OPEN_NOMUTEX;
+    else
+      opts |= SQLITE_OPEN_FULLMUTEX;
+    if(theOpenSharedCache)
+      opts |= SQLITE_OPEN_SHAREDCACHE;
+    return opts;
+  }
+  
+  std::string
+  SqliteOptions::getOptionsAsString(){
+    std::string res;
+    bool somethingthere = false;
+    if(theOpenCreate)
+    {
+      res += "SQLITE_OPEN_CREATE";
+      somethingthere = true;
+    }
+    if(theOpenReadOnly)
+    {
+      if(somethingthere)
+      {
+        res += " | ";
+      }
+      res += "SQLITE_OPEN_READONLY";
+      somethingthere = true;
+    }
+    else
+    {
+      if(somethingthere)
+      {
+        res += " | ";
+      }
+      res += "SQLITE_OPEN_READWRITE";
+      somethingthere = true;
+    }
+    if(theOpenNoMutex)
+    {
+      if(somethingthere)
+      {
+        res += " | ";
+      }
+      res += "SQLITE_OPEN_NOMUTEX";
+      somethingthere = true;
+    }
+    if(theOpenSharedCache)
+    {
+      if(somethingthere)
+      {
+        res += " | ";
+      }
+      res += "SQLITE_OPEN_SHAREDCACHE";
+    }
+    return res;
+  }
+
+/*******************************************************************************
+ *                                QueryOptions                                 *
+ ******************************************************************************/
+  QueryOptions::QueryOptions()
+    : theResultFormat(OBJECTS), thePrefetch(0), theTimeout(-1) {}
+
+  void
+  QueryOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      Item lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+      std::string lValue = lOptionValue.getStringValue().str();
+
+      if (lItemJSONKey.getStringValue() == "result-format")
+      {
+        if(lValue == "objects")
+          theResultFormat = OBJECTS;
+        else if(lValue == "arrays")
+          theResultFormat = ARRAYS;
+        else if(lValue == "columnar")
+          theResultFormat = COLUMNAR;
+        else
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      "result-format: " + lValue).c_str());
+      }
+      else if (lItemJSONKey.getStringValue() == "prefetch")
+      {
+        char* lEnd;
+        long lDepth = strtol(lValue.c_str(), &lEnd, 10);
+        if(lValue.empty() || *lEnd != '\0' || lDepth < 0 || lDepth > MAX_PREFETCH)
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      "prefetch: " + lValue).c_str());
+        thePrefetch = (unsigned int)lDepth;
+      }
+      else if (lItemJSONKey.getStringValue() == "timeout-ms")
+      {
+        char* lEnd;
+        long lTimeout = strtol(lValue.c_str(), &lEnd, 10);
+        if(lValue.empty() || *lEnd != '\0' || lTimeout < 0 || lTimeout > INT_MAX)
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      "timeout-ms: " + lValue).c_str());
+        theTimeout = (int)lTimeout;
+      } else
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lItemJSONKey.getStringValue().str()).c_str());
+    }
+    lIterKeys->close();
+  }
+
+/*******************************************************************************
+ *                                BatchOptions                                 *
+ ******************************************************************************/
+  void
+  BatchOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      std::string lKey = lItemJSONKey.getStringValue().str();
+      Item lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+
+      if (lKey == "transaction")
+      {
+        // true writes from the start, a deferred transaction could fail to
+        // get the write lock halfway through the rows
+        if(lOptionValue.isAtomic() && lOptionValue.getTypeCode() == store::XS_BOOLEAN)
+          theTransaction = lOptionValue.getBooleanValue()?
+                           Connection::TX_IMMEDIATE:Connection::TX_NONE;
+        else
+          theTransaction = Connection::getModeFromString(
+            lOptionValue.getStringValue().str());
+      } else
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lKey).c_str());
+    }
+    lIterKeys->close();
+  }
+
+/*******************************************************************************
+ *                                  RowBuffer                                  *
+ ******************************************************************************/
+  RowBuffer::RowBuffer(sqlite3_stmt* aStmt, int aColumnCount, unsigned int aDepth,
+                       bool aStepped, QueryTimer* aTimer, sqlite3_int64 aDeadline)
+    : theStmt(aStmt), theColumnCount(aColumnCount), theDepth(aDepth),
+      theValues(aDepth * aColumnCount), theHead(0), theCount(0),
+      theFinished(false), theCancelled(false), theRc(SQLITE_ROW),
+      theTimer(aTimer), theDeadline(aDeadline),
+      theThread(&RowBuffer::run, this)
+  {
+    if(aStepped)
+    {
+      decode(aStmt, aColumnCount, &theValues[0]);
+      theCount = 1;
+    }
+  }
+
+  void
+  RowBuffer::run(void* aBuffer)
+  {
+    static_cast<RowBuffer*>(aBuffer)->produce();
+  }
+
+  void
+  RowBuffer::decode(sqlite3_stmt* aStmt, int aColumnCount, Value* aRow)
+  {
+    for(int i=0; i<aColumnCount; i++)
+    {
+      Value& lValue = aRow[i];
+      lValue.theType = sqlite3_column_type(aStmt, i);
+      switch(lValue.theType){
+      case SQLITE_NULL:
+        break;
+      case SQLITE_INTEGER:
+        lValue.theInteger = sqlite3_column_int64(aStmt, i);
+        break;
+      case SQLITE_FLOAT:
+        lValue.theDouble = sqlite3_column_double(aStmt, i);
+        break;
+      case SQLITE_BLOB:
+        {
+          const char* lBlob = (const char*)sqlite3_column_blob(aStmt, i);
+          lValue.theBytes.assign(lBlob == NULL ? "" : lBlob, sqlite3_column_bytes(aStmt, i));
+        }
+        break;
+      default:
+        {
+          const char* lText = (const char*)sqlite3_column_text(aStmt, i);
+          lValue.theBytes.assign(lText == NULL ? "" : lText, sqlite3_column_bytes(aStmt, i));
+        }
+      }
+    }
+  }
+
+  zorba::Item
+  RowBuffer::createItem(zorba::ItemFactory* aFactory, const Value& aValue)
+  {
+    switch(aValue.theType){
+    case SQLITE_NULL:
+      return aFactory->createJSONNull();
+    case SQLITE_INTEGER:
+      return aFactory->createLong(aValue.theInteger);
+    case SQLITE_FLOAT:
+      return aFactory->createDouble(aValue.theDouble);
+    case SQLITE_BLOB:
+      return aFactory->createBase64Binary(aValue.theBytes.data(),
+                                          aValue.theBytes.size(), true);
+    default:
+      return aFactory->createString(zorba::String(aValue.theBytes));
+    }
+  }
+
+  int
+  RowBuffer::compare(const Value& aValue1, const Value& aValue2)
+  {
+    // NULL, numbers, text, blob
+    static const int theRanks[] = { 0, 1, 1, 2, 3, 0 };
+    int lRank1 = theRanks[aValue1.theType];
+    int lRank2 = theRanks[aValue2.theType];
+    if(lRank1 != lRank2)
+      return lRank1 - lRank2;
+
+    switch(lRank1){
+    case 0:
+      return 0;
+    case 1:
+      if(aValue1.theType == SQLITE_INTEGER && aValue2.theType == SQLITE_INTEGER)
+        return (aValue1.theInteger < aValue2.theInteger)?-1:
+               (aValue1.theInteger > aValue2.theInteger)?1:0;
+      else
+      {
+        double lDouble1 = (aValue1.theType == SQLITE_INTEGER)?
+          (double)aValue1.theInteger:aValue1.theDouble;
+        double lDouble2 = (aValue2.theType == SQLITE_INTEGER)?
+          (double)aValue2.theInteger:aValue2.theDouble;
+        return (lDouble1 < lDouble2)?-1:(lDouble1 > lDouble2)?1:0;
+      }
+    default:
+      {
+        size_t lSize1 = aValue1.theBytes.size();
+        size_t lSize2 = aValue2.theBytes.size();
+        int lCmp = memcmp(aValue1.theBytes.data(), aValue2.theBytes.data(),
+                          (lSize1 < lSize2)?lSize1:lSize2);
+        if(lCmp != 0)
+          return lCmp;
+        return (lSize1 < lSize2)?-1:(lSize1 > lSize2)?1:0;
+      }
+    }
+  }
+
+  void
+  RowBuffer::produce()
+  {
+    for(;;)
+    {
+      unsigned int lSlot;
+      {
+        MutexLock lLock(theMutex);
+        while(theCount == theDepth && !theCancelled)
+          theNotFull.wait(theMutex);
+        if(theCancelled)
+          return;
+        // The query thread only moves theHead forward as it frees rows, the
+        // free slot after the last row stays the same
+        lSlot = (theHead + theCount) % theDepth;
+      }
+
+      int lRc = (theTimer == NULL)?sqlite3_step(theStmt):
+                                   theTimer->step(theStmt, theDeadline);
+      if(lRc == SQLITE_ROW)
+        decode(theStmt, theColumnCount, &theValues[lSlot * theColumnCount]);
+
+      MutexLock lLock(theMutex);
+      if(lRc == SQLITE_ROW)
+        ++theCount;
+      else
+      {
+        theRc = lRc;
+        if(lRc != SQLITE_DONE)
+          theError = sqlite3_errmsg(sqlite3_db_handle(theStmt));
+        theFinished = true;
+      }
+      theNotEmpty.signal();
+      if(theFinished)
+        return;
+    }
+  }
+
+  const RowBuffer::Value*
+  RowBuffer::front()
+  {
+    MutexLock lLock(theMutex);
+    while(theCount == 0 && !theFinished)
+      theNotEmpty.wait(theMutex);
+    if(theCount == 0)
+      return NULL;
+    return &theValues[theHead * theColumnCount];
+  }
+
+  void
+  RowBuffer::pop()
+  {
+    MutexLock lLock(theMutex);
+    theHead = (theHead + 1) % theDepth;
+    --theCount;
+    theNotFull.signal();
+  }
+
+  void
+  RowBuffer::stop()
+  {
+    {
+      MutexLock lLock(theMutex);
+      theCancelled = true;
+      theNotFull.signal();
+    }
+    theThread.join();
+  }
+
+/*******************************************************************************
+ *                                UserFunction                                 *
+ ******************************************************************************/
+  UserFunction::UserFunction(const zorba::Item& aFunction, unsigned int aMemoSize)
+    : theFunction(aFunction), theAggregate(false), theMemoSize(aMemoSize),
+      theDepth(0), theThread(currentThreadId()) {}
+
+  UserFunction::UserFunction(const zorba::Item& aStep, const zorba::Item& aFinal,
+                             const Sequence_t& aInitial)
+    : theFunction(aStep), theFinal(aFinal), theInitial(aInitial),
+      theAggregate(true), theMemoSize(0), theDepth(0),
+      theThread(currentThreadId()) {}
+
+  UserFunction::~UserFunction()
+  {
+    for(Callers_t::iterator lIt = theCallers.begin(); lIt != theCallers.end(); ++lIt)
+      lIt->second->close();
+  }
+
+  bool
+  UserFunction::isCallable(sqlite3_context* aCtx) const
+  {
+    if(isCurrentThread(theThread))
+      return true;
+    sqlite3_result_error(aCtx, "Function can only be called on the query thread", -1);
+    return false;
+  }
+
+  std::string
+  UserFunction::getCaller(int aArgc)
+  {
+    std::ostringstream lQuery;
+    lQuery << "declare variable $f external;\n";
+    for(int i=1; i<=aArgc; i++)
+      lQuery << "declare variable $a" << i << " external;\n";
+    lQuery << "$f(";
+    for(int i=1; i<=aArgc; i++)
+      lQuery << ((i > 1)?", ":"") << "$a" << i;
+    lQuery << ")";
+    return lQuery.str();
+  }
+
+  void
+  UserFunction::call(const zorba::Item& aFunction,
+                     const std::vector<Sequence_t>& aArgs,
+                     Sequence_t& aResult)
+  {
+    int lArgc = (int)aArgs.size();
+    XQuery_t lQuery;
+
+    // A function running SQL that calls it again can't reuse the query
+    // being executed, it gets one of its own
+    bool lNested = theDepth > 0;
+    Callers_t::iterator lIt = theCallers.find(lArgc);
+    if(!lNested && lIt != theCallers.end())
+      lQuery = lIt->second;
+    else
+    {
+      lQuery = Zorba::getInstance(0)->compileQuery(getCaller(lArgc));
+      if(!lNested)
+        theCallers[lArgc] = lQuery;
+    }
+
+    DynamicContext* lDctx = lQuery->getDynamicContext();
+    std::vector<ItemSequence_t> lSequences;
+    lDctx->setVariable("f", aFunction);
+    for(int i=0; i<lArgc; i++)
+    {
+      std::ostringstream lName;
+      lName << "a" << (i + 1);
+      if(aArgs[i].size() == 1)
+        lDctx->setVariable(lName.str(), aArgs[i][0]);
+      else
+      {
+        lSequences.push_back(new VectorItemSequence(aArgs[i]));
+        lDctx->setVariable(lName.str(), lSequences.back()->getIterator());
+      }
+    }
+
+    ++theDepth;
+    try
+    {
+      Item lItem;
+      Iterator_t lIter = lQuery->iterator();
+      lIter->open();
+      while(lIter->next(lItem))
+        aResult.push_back(lItem);
+      lIter->close();
+    }
+    catch (...)
+    {
+      --theDepth;
+      if(lNested)
+        lQuery->close();
+      throw;
+    }
+    --theDepth;
+    if(lNested)
+      lQuery->close();
+  }
+
+  void
+  UserFunction::decode(sqlite3_value* aValue, RowBuffer::Value& aResult)
+  {
+    aResult.theType = sqlite3_value_type(aValue);
+    switch(aResult.theType){
+    case SQLITE_NULL:
+      break;
+    case SQLITE_INTEGER:
+      aResult.theInteger = sqlite3_value_int64(aValue);
+      break;
+    case SQLITE_FLOAT:
+      aResult.theDouble = sqlite3_value_double(aValue);
+      break;
+    case SQLITE_BLOB:
+      {
+        const char* lBlob = (const char*)sqlite3_value_blob(aValue);
+        aResult.theBytes.assign(lBlob == NULL ? "" : lBlob, sqlite3_value_bytes(aValue));
+      }
+      break;
+    default:
+      {
+        const char* lText = (const char*)sqlite3_value_text(aValue);
+        aResult.theBytes.assign(lText == NULL ? "" : lText, sqlite3_value_bytes(aValue));
+      }
+    }
+  }
+
+  void
+  UserFunction::encode(const Sequence_t& aValue, RowBuffer::Value& aResult)
+  {
+    if(aValue.empty())
+      aResult.theType = SQLITE_NULL;
+    else if(aValue.size() > 1)
+      SqliteFunction::throwError("INVALID-VALUE",
+                                 SqliteFunction::getErrorMessage("INVALID-VALUE"));
+    else
+      SqliteFunction::getItemValue(aValue[0], aResult);
+  }
+
+  void
+  UserFunction::setResult(sqlite3_context* aCtx, const RowBuffer::Value& aValue)
+  {
+    switch(aValue.theType){
+    case SQLITE_NULL:
+      sqlite3_result_null(aCtx);
+      break;
+    case SQLITE_INTEGER:
+      sqlite3_result_int64(aCtx, aValue.theInteger);
+      break;
+    case SQLITE_FLOAT:
+      sqlite3_result_double(aCtx, aValue.theDouble);
+      break;
+    case SQLITE_BLOB:
+      sqlite3_result_blob(aCtx, aValue.theBytes.data(),
+                          (int)aValue.theBytes.size(), SQLITE_TRANSIENT);
+      break;
+    default:
+      sqlite3_result_text(aCtx, aValue.theBytes.data(),
+                          (int)aValue.theBytes.size(), SQLITE_TRANSIENT);
+    }
+  }
+
+  void
+  UserFunction::callScalar(sqlite3_context* aCtx, int aArgc, sqlite3_value** aArgv)
+  {
+    UserFunction* lFunction = static_cast<UserFunction*>(sqlite3_user_data(aCtx));
+    if(!lFunction->isCallable(aCtx))
+      return;
+
+    // Exceptions must not go through SQLite, they become the error of the
+    // statement
+    try
+    {
+      std::vector<RowBuffer::Value> lValues(aArgc);
+      std::string lKey;
+      for(int i=0; i<aArgc; i++)
+      {
+        decode(aArgv[i], lValues[i]);
+        if(lFunction->theMemoSize == 0)
+          continue;
+        // type, then the value with its length
+        RowBuffer::Value& lValue = lValues[i];
+        lKey += (char)('0' + lValue.theType);
+        if(lValue.theType == SQLITE_INTEGER)
+          lKey.append((const char*)&lValue.theInteger, sizeof(lValue.theInteger));
+        else if(lValue.theType == SQLITE_FLOAT)
+          lKey.append((const char*)&lValue.theDouble, sizeof(lValue.theDouble));
+        else if(lValue.theType != SQLITE_NULL)
+        {
+          size_t lSize = lValue.theBytes.size();
+          lKey.append((const char*)&lSize, sizeof(lSize));
+          lKey += lValue.theBytes;
+        }
+      }
+      if(lFunction->theMemoSize > 0)
+      {
+        Memo_t::const_iterator lIt = lFunction->theMemo.find(lKey);
+        if(lIt != lFunction->theMemo.end())
+        {
+          setResult(aCtx, lIt->second);
+          return;
+        }
+      }
+
+      ItemFactory* lFactory = SqliteModule::getItemFactory();
+      std::vector<Sequence_t> lArgs(aArgc);
+      for(int i=0; i<aArgc; i++)
+        lArgs[i].push_back(RowBuffer::createItem(lFactory, lValues[i]));
+      Sequence_t lResult;
+      lFunction->call(lFunction->theFunction, lArgs, lResult);
+
+      RowBuffer::Value lValue;
+      encode(lResult, lValue);
+      if(lFunction->theMemoSize > 0)
+      {
+        if(lFunction->theMemo.size() >= lFunction->theMemoSize)
+          lFunction->theMemo.clear();
+        lFunction->theMemo[lKey] = lValue;
+      }
+      setResult(aCtx, lValue);
+    }
+    catch (std::exception& e)
+    {
+      sqlite3_result_error(aCtx, e.what(), -1);
+    }
+    catch (...)
+    {
+      sqlite3_result_error(aCtx, "Function call failed", -1);
+    }
+  }
+
+  void
+  UserFunction::callStep(sqlite3_context* aCtx, int aArgc, sqlite3_value** aArgv)
+  {
+    UserFunction* lFunction = static_cast<UserFunction*>(sqlite3_user_data(aCtx));
+    if(!lFunction->isCallable(aCtx))
+      return;
+
+    // The accumulator of the group, freed by callFinal()
+    Sequence_t** lState =
+      static_cast<Sequence_t**>(sqlite3_aggregate_context(aCtx, sizeof(Sequence_t*)));
+    if(lState == NULL)
+    {
+      sqlite3_result_error_nomem(aCtx);
+      return;
+    }
+
+    try
+    {
+      if(*lState == NULL)
+        *lState = new Sequence_t(lFunction->theInitial);
+
+      ItemFactory* lFactory = SqliteModule::getItemFactory();
+      std::vector<Sequence_t> lArgs(aArgc + 1);
+      lArgs[0] = **lState;
+      for(int i=0; i<aArgc; i++)
+      {
+        RowBuffer::Value lValue;
+        decode(aArgv[i], lValue);
+        lArgs[i + 1].push_back(RowBuffer::createItem(lFactory, lValue));
+      }
+      Sequence_t lResult;
+      lFunction->call(lFunction->theFunction, lArgs, lResult);
+      (*lState)->swap(lResult);
+    }
+    catch (std::exception& e)
+    {
+      sqlite3_result_error(aCtx, e.what(), -1);
+    }
+    catch (...)
+    {
+      sqlite3_result_error(aCtx, "Function call failed", -1);
+    }
+  }
+
+  void
+  UserFunction::callFinal(sqlite3_context* aCtx)
+  {
+    UserFunction* lFunction = static_cast<UserFunction*>(sqlite3_user_data(aCtx));
+    // No accumulator if the group has no rows
+    Sequence_t** lState = static_cast<Sequence_t**>(sqlite3_aggregate_context(aCtx, 0));
+    Sequence_t* lAccumulator = (lState == NULL)?NULL:*lState;
+
+    if(lFunction->isCallable(aCtx))
+    {
+      try
+      {
+        const Sequence_t& lValue =
+          (lAccumulator == NULL)?lFunction->theInitial:*lAccumulator;
+        Sequence_t lResult;
+        if(lFunction->theFinal.isNull())
+          lResult = lValue;
+        else
+        {
+          std::vector<Sequence_t> lArgs(1, lValue);
+          lFunction->call(lFunction->theFinal, lArgs, lResult);
+        }
+        RowBuffer::Value lSqlValue;
+        encode(lResult, lSqlValue);
+        setResult(aCtx, lSqlValue);
+      }
+      catch (std::exception& e)
+      {
+        sqlite3_result_error(aCtx, e.what(), -1);
+      }
+      catch (...)
+      {
+        sqlite3_result_error(aCtx, "Function call failed", -1);
+      }
+    }
+    delete lAccumulator;
+  }
+
+  void
+  UserFunction::destroy(void* aFunction)
+  {
+    delete static_cast<UserFunction*>(aFunction);
+  }
+
+/*******************************************************************************
+ *                                  AsyncJob                                   *
+ ******************************************************************************/
+  void
+  AsyncJob::execute()
+  {
+    int lColumnCount = sqlite3_column_count(theStmt);
+    for(int i=0; i<lColumnCount; i++)
+      theColumns.push_back(sqlite3_column_name(theStmt, i));
+
+    for(;;)
+    {
+      if(isInterrupted())
+      {
+        theRc = SQLITE_INTERRUPT;
+        break;
+      }
+      theRc = sqlite3_step(theStmt);
+      if(theRc != SQLITE_ROW)
+        break;
+      theRows.push_back(std::vector<RowBuffer::Value>(lColumnCount));
+      if(lColumnCount > 0)
+        RowBuffer::decode(theStmt, lColumnCount, &theRows.back()[0]);
+    }
+    if(theRc == SQLITE_INTERRUPT)
+      theError = sqlite3_errstr(theRc);
+    else if(theRc != SQLITE_DONE)
+      theError = sqlite3_errmsg(theDb);
+    sqlite3_reset(theStmt);
+  }
+
+  void
+  AsyncJob::interrupt()
+  {
+    MutexLock lLock(theInterruptMutex);
+    theInterrupted = true;
+  }
+
+  bool
+  AsyncJob::isInterrupted()
+  {
+    MutexLock lLock(theInterruptMutex);
+    return theInterrupted;
+  }
+
+/*******************************************************************************
+ *                                AsyncExecutor                                *
+ ******************************************************************************/
+  AsyncExecutor* AsyncExecutor::theInstance = NULL;
+  Mutex AsyncExecutor::theInstanceMutex;
+
+  AsyncExecutor*
+  AsyncExecutor::getInstance()
+  {
+    MutexLock lLock(theInstanceMutex);
+    if(theInstance == NULL)
+      theInstance = new AsyncExecutor();
+    return theInstance;
+  }
+
+  void
+  AsyncExecutor::shutdown()
+  {
+    MutexLock lLock(theInstanceMutex);
+    delete theInstance;
+    theInstance = NULL;
+  }
+
+  AsyncExecutor::~AsyncExecutor()
+  {
+    {
+      MutexLock lLock(theMutex);
+      theStopping = true;
+      theWork.broadcast();
+    }
+    // A running job is finished by its worker first
+    for(size_t i=0; i<theThreads.size(); i++)
+    {
+      theThreads[i]->join();
+      delete theThreads[i];
+    }
+
+    MutexLock lLock(theMutex);
+    while(!theQueue.empty())
+    {
+      AsyncJob* lJob = theQueue.front();
+      theQueue.pop_front();
+      lJob->theRc = SQLITE_ABORT;
+      lJob->theError = "module unloaded";
+      finishJob(lJob);
+      if(lJob->theAbandoned)
+        freeJob(lJob);
+    }
+    theDone.broadcast();
+    for(Idle_t::iterator lIter = theIdle.begin(); lIter != theIdle.end(); ++lIter)
+      sqlite3_close_v2(lIter->second);
+    theIdle.clear();
+  }
+
+  void
+  AsyncExecutor::run(void* aExecutor)
+  {
+    static_cast<AsyncExecutor*>(aExecutor)->work();
+  }
+
+  void
+  AsyncExecutor::work()
+  {
+    for(;;)
+    {
+      AsyncJob* lJob;
+      {
+        MutexLock lLock(theMutex);
+        while(theQueue.empty() && !theStopping)
+          theWork.wait(theMutex);
+        if(theStopping)
+          return;
+        lJob = theQueue.front();
+        theQueue.pop_front();
+        lJob->theState = AsyncJob::RUNNING;
+      }
+
+      lJob->execute();
+
+      MutexLock lLock(theMutex);
+      finishJob(lJob);
+      if(lJob->theAbandoned)
+        freeJob(lJob);
+      theDone.broadcast();
+    }
+  }
+
+  sqlite3*
+  AsyncExecutor::takeConnection(const std::string& aFile)
+  {
+    {
+      MutexLock lLock(theMutex);
+      Idle_t::iterator lIter = theIdle.find(aFile);
+      if(lIter != theIdle.end())
+      {
+        sqlite3* lDb = lIter->second;
+        theIdle.erase(lIter);
+        return lDb;
+      }
+    }
+
+    sqlite3* lDb = NULL;
+    if(sqlite3_open_v2(aFile.c_str(), &lDb,
+                       SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK)
+    {
+      sqlite3_close(lDb);
+      return NULL;
+    }
+    return lDb;
+  }
+
+  void
+  AsyncExecutor::returnConnection(const std::string& aFile, sqlite3* aDb)
+  {
+    MutexLock lLock(theMutex);
+    // One idle connection per worker is enough for any file
+    if(theStopping || theIdle.count(aFile) >= DEFAULT_THREADS)
+      sqlite3_close_v2(aDb);
+    else
+      theIdle.insert(std::pair<std::string, sqlite3*>(aFile, aDb));
+  }
+
+  void
+  AsyncExecutor::submit(AsyncJob* aJob)
+  {
+    MutexLock lLock(theMutex);
+    // The workers are only started by the first job
+    while(theThreads.size() < DEFAULT_THREADS)
+    {
+      Thread* lThread = new Thread(&AsyncExecutor::run, this);
+      if(!lThread->start())
+      {
+        delete lThread;
+        break;
+      }
+      theThreads.push_back(lThread);
+    }
+    if(theThreads.empty())
+    {
+      // No thread available, the job runs on the query thread
+      aJob->execute();
+      aJob->theState = AsyncJob::DONE;
+      return;
+    }
+    if(aJob->theFile.empty())
+      ++theBusy[aJob->theDb];
+    theQueue.push_back(aJob);
+    theWork.signal();
+  }
+
+  void
+  AsyncExecutor::wait(AsyncJob* aJob)
+  {
+    MutexLock lLock(theMutex);
+    while(aJob->theState != AsyncJob::DONE)
+      theDone.wait(theMutex);
+  }
+
+  size_t
+  AsyncExecutor::waitAny(const std::vector<AsyncJob*>& aJobs)
+  {
+    MutexLock lLock(theMutex);
+    for(;;)
+    {
+      for(size_t i=0; i<aJobs.size(); i++)
+      {
+        if(aJobs[i]->theState == AsyncJob::DONE)
+          return i;
+      }
+      theDone.wait(theMutex);
+    }
+  }
+
+  void
+  AsyncExecutor::release(AsyncJob* aJob)
+  {
+    MutexLock lLock(theMutex);
+    switch(aJob->theState){
+    case AsyncJob::QUEUED:
+      theQueue.remove(aJob);
+      finishJob(aJob);
+      freeJob(aJob);
+      break;
+    case AsyncJob::RUNNING:
+      aJob->interrupt();
+      sqlite3_interrupt(aJob->theDb);
+      // The connection of a job on a file is its own, the caller's one goes
+      // back to its pool or is closed once the query ends
+      if(!aJob->theFile.empty())
+      {
+        aJob->theAbandoned = true;
+        break;
+      }
+      while(aJob->theState != AsyncJob::DONE)
+        theDone.wait(theMutex);
+      freeJob(aJob);
+      break;
+    default:
+      freeJob(aJob);
+    }
+  }
+
+  void
+  AsyncExecutor::releaseJobs(const std::vector<AsyncJob*>& aJobs)
+  {
+    MutexLock lLock(theInstanceMutex);
+    for(size_t i=0; i<aJobs.size(); i++)
+    {
+      if(theInstance != NULL)
+      {
+        theInstance->release(aJobs[i]);
+        continue;
+      }
+      // Every job is done once the executor is gone
+      sqlite3_finalize(aJobs[i]->theStmt);
+      if(!aJobs[i]->theFile.empty())
+        sqlite3_close_v2(aJobs[i]->theDb);
+      delete aJobs[i];
+    }
+  }
+
+  bool
+  AsyncExecutor::hasJobs(sqlite3* aDb)
+  {
+    MutexLock lLock(theInstanceMutex);
+    if(theInstance == NULL)
+      return false;
+    MutexLock lJobsLock(theInstance->theMutex);
+    return theInstance->theBusy.find(aDb) != theInstance->theBusy.end();
+  }
+
+  void
+  AsyncExecutor::interrupt(AsyncJob* aJob)
+  {
+    MutexLock lLock(theMutex);
+    if(aJob->theState == AsyncJob::DONE)
+      return;
+    // A queued job stops before its first row, a job on the caller's
+    // connection interrupts the other statements running on it too
+    aJob->interrupt();
+    if(aJob->theState == AsyncJob::RUNNING)
+      sqlite3_interrupt(aJob->theDb);
+  }
+
+  void
+  AsyncExecutor::finishJob(AsyncJob* aJob)
+  {
+    aJob->theState = AsyncJob::DONE;
+    if(!aJob->theFile.empty())
+      return;
+    Busy_t::iterator lBusy = theBusy.find(aJob->theDb);
+    if(lBusy != theBusy.end() && --lBusy->second == 0)
+      theBusy.erase(lBusy);
+  }
+
+  void
+  AsyncExecutor::freeJob(AsyncJob* aJob)
+  {
+    sqlite3_finalize(aJob->theStmt);
+    if(!aJob->theFile.empty())
+    {
+      // Can't call returnConnection, theMutex is held already
+      if(theStopping || theIdle.count(aJob->theFile) >= DEFAULT_THREADS)
+        sqlite3_close_v2(aJob->theDb);
+      else
+        theIdle.insert(std::pair<std::string, sqlite3*>(aJob->theFile, aJob->theDb));
+    }
+    delete aJob;
+  }
+
+/*******************************************************************************
+ *                                  AsyncMap                                   *
+ ******************************************************************************/
+  void
+  AsyncMap::destroy() throw()
+  {
+    std::vector<AsyncJob*> lJobs;
+    theJobs.removeAll(lJobs);
+    AsyncExecutor::releaseJobs(lJobs);
+    delete this;
+  }
+
+/*******************************************************************************
+ *                              JSONItemSequence                               *
+ ******************************************************************************/
+  JSONItemSequence::~JSONItemSequence()
+  {
+    // Nobody iterated over the result, give the statement back
+    if(theCache != NULL && thePrepStmt != NULL)
+      theCache->release(theSql, thePrepStmt);
+  }
+
+  zorba::Iterator_t
+  JSONItemSequence::getIterator()
+  {
+    if(theCache == NULL)
+      return new JSONIterator(thePrepStmt, NULL, theSql, theOptions, theTimer);
+
+    // The first iterator takes over the statement prepared by the function,
+    // later ones take their own one from the cache
+    sqlite3_stmt* lStmt = thePrepStmt;
+    thePrepStmt = NULL;
+    return new JSONIterator(lStmt, theCache, theSql, theOptions, theTimer);
+  }
+
+/*******************************************************************************
+ *                         JSONItemSequence::JSONIterator                      *
+ ******************************************************************************/
+  void JSONItemSequence::JSONIterator::releaseStatement(){
+    if(theCache != NULL && theStmt != NULL)
+    {
+      theCache->release(theSql, theStmt);
+      theStmt = NULL;
+    }
+  }
+
+  int JSONItemSequence::JSONIterator::step(){
+    if(theTimer == NULL)
+      return sqlite3_step(theStmt);
+    return theTimer->step(theStmt, theDeadline);
+  }
+
+  void JSONItemSequence::JSONIterator::fail(const std::string& aError){
+    int lRc = theRc;
+    theRc = SQLITE_ERROR;
+    stopPrefetch();
+    if(theStmt != NULL)
+      sqlite3_reset(theStmt);
+    releaseStatement();
+    SqliteFunction::throwStepError(lRc, aError, theDeadline);
+  }
+
+  void JSONItemSequence::JSONIterator::open(){
+    if(theStmt == NULL && theCache != NULL)
+      theStmt = theCache->acquire(theSql);
+    // Get data and create the column names
+    if(theStmt != NULL){
+      // The timeout counts from the start of the query, whatever time the
+      // caller takes between the rows
+      theDeadline = (theTimer == NULL)?0:theTimer->getDeadline(theOptions.getTimeout());
+      theRc = step();
+      if(theRc != SQLITE_ROW && theRc != SQLITE_DONE)
+        fail(sqlite3_errmsg(sqlite3_db_handle(theStmt)));
+      theFactory = Zorba::getInstance(0)->getItemFactory();
+      theHeaderReturned = false;
+
+      theColumnCount = sqlite3_column_count(theStmt);
+      // Queries without rows still return their header in the other formats
+      if(theRc == SQLITE_DONE &&
+         (theOptions.getResultFormat() == QueryOptions::OBJECTS || theColumnCount == 0))
+        isUpdateResult = true;
+      // the key items are created once and shared by all the rows
+      theColumnNamesZString.clear();
+      for(int i=0; i<theColumnCount; i++)
+        theColumnNamesZString.push_back(
+          theFactory->createString(sqlite3_column_name(theStmt, i)));
+
+      // The worker thread steps the statement while the rows are turned into
+      // items here; connections opened without a mutex can't be shared with
+      // it, their rows are read synchronously
+      if(theRc == SQLITE_ROW && theColumnCount > 0 &&
+         theOptions.getPrefetch() > 0 &&
+         sqlite3_db_mutex(sqlite3_db_handle(theStmt)) != NULL)
+      {
+        thePrefetch = new RowBuffer(theStmt, theColumnCount, theOptions.getPrefetch(),
+                                    true, theTimer, theDeadline);
+        if(thePrefetch->start())
+          theRow = thePrefetch->front();
+        else
+          stopPrefetch();
+      }
+    }
+  }
+
+  void JSONItemSequence::JSONIterator::stopPrefetch(){
+    if(thePrefetch != NULL)
+    {
+      thePrefetch->stop();
+      delete thePrefetch;
+      thePrefetch = NULL;
+      theRow = NULL;
+    }
+  }
+
+  void JSONItemSequence::JSONIterator::stepRow(){
+    if(thePrefetch != NULL)
+    {
+      thePrefetch->pop();
+      theRow = thePrefetch->front();
+      if(theRow != NULL)
+        return;
+      theRc = thePrefetch->getRc();
+      if(theRc != SQLITE_DONE)
+        fail(thePrefetch->getError());
+      stopPrefetch();
+      sqlite3_reset(theStmt);
+      releaseStatement();
+      return;
+    }
+    // Get more data if available
+    theRc = step();
+    if(theRc == SQLITE_DONE)
+    {
+      // The result is consumed, a cached statement can be reused already
+      sqlite3_reset(theStmt);
+      releaseStatement();
+    }
+    else if(theRc != SQLITE_ROW)
+      fail(sqlite3_errmsg(sqlite3_db_handle(theStmt)));
+  }
+
+  zorba::Item JSONItemSequence::JSONIterator::getColumnValue(int i){
+    int aType, aSize;
+    zorba::Item aValue;
+    const char *aBlobPtr;
+
+    if(theRow != NULL)
+      return RowBuffer::createItem(theFactory, theRow[i]);
+
+    aType = sqlite3_column_type(theStmt, i);
+    switch(aType){
+    case SQLITE_NULL:
+      aValue = theFactory->createJSONNull();
+      break;
+    case SQLITE_INTEGER: 
+      // rowids and timestamps don't fit in 32 bits
+      aValue = theFactory->createLong(sqlite3_column_int64(theStmt, i));
+      break;
+    case SQLITE_FLOAT:
+      aValue = theFactory->createDouble(sqlite3_column_double(theStmt, i));
+      break;
+    case SQLITE_BLOB:
+      aSize = sqlite3_column_bytes(theStmt, i);
+      aBlobPtr = (const char *)sqlite3_column_blob(theStmt, i);
+      aValue = theFactory->createBase64Binary(aBlobPtr, aSize, true);
+      break;
+    default:
+      // sqlite3_column_bytes must come after sqlite3_column_text so the
+      // length matches the UTF-8 text returned
+      const char* lText = (const char *)sqlite3_column_text(theStmt, i);
+      aSize = sqlite3_column_bytes(theStmt, i);
+      aValue = theFactory->createString(zorba::String(lText, aSize));
+    }
+    return aValue;
+  }
+
+  bool JSONItemSequence::JSONIterator::next(zorba::Item& aItem){
+    zorba::Item aValue;
+    std::vector<std::pair<zorba::Item, zorba::Item> > elements;
+    std::vector<zorba::Item> values;
+
+    if(theOptions.getResultFormat() == QueryOptions::ARRAYS &&
+       !theHeaderReturned && !isUpdateResult && theColumnCount > 0){
+      // the column names are returned once, before the first row
+      aItem = theFactory->createJSONArray(theColumnNamesZString);
+      theHeaderReturned = true;
+      return true;
+    } else if(theOptions.getResultFormat() == QueryOptions::COLUMNAR &&
+              !theHeaderReturned && !isUpdateResult && theColumnCount > 0){
+      // a single object with one array of values per column
+      std::vector<std::vector<zorba::Item> > lColumns(theColumnCount);
+      while(theRc == SQLITE_ROW){
+        for(int i=0; i<theColumnCount; i++)
+          lColumns[i].push_back(getColumnValue(i));
+        stepRow();
+      }
+      for(int i=0; i<theColumnCount; i++)
+        elements.push_back(std::pair<zorba::Item, zorba::Item>(theColumnNamesZString.at(i),
+                           theFactory->createJSONArray(lColumns[i])));
+      aItem = theFactory->createJSONObject(elements);
+      theHeaderReturned = true;
+      return true;
+    } else if(theRc == SQLITE_ROW){
+      if(theOptions.getResultFormat() == QueryOptions::ARRAYS){
+        // one array per row, in the same order as the header
+        for(int i=0; i<theColumnCount; i++)
+          values.push_back(getColumnValue(i));
+        aItem = theFactory->createJSONArray(values);
+      } else {
+        // get the resulting data from the statement
+        // in a key = value fashion
+        for(int i=0; i<theColumnCount; i++)
+          elements.push_back(std::pair<zorba::Item, zorba::Item>(theColumnNamesZString.at(i), getColumnValue(i)));
+        aItem = theFactory->createJSONObject(elements);
+      }
+      stepRow();
+      return true;
+    } else if(isUpdateResult && theRc == SQLITE_DONE){
+      // we have a prepared statement that represents a UPDATE and it's already executed
+      aValue = theFactory->createInt(sqlite3_changes(sqlite3_db_handle(theStmt)));
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::AFFECTED_ROWS), aValue));
+      aItem = theFactory->createJSONObject(elements);
+      elements.clear();
+      sqlite3_reset(theStmt);
+      releaseStatement();
+      // be sure it won't be back in here
+      theRc = SQLITE_ERROR;
+      return true;
+    } else
+      // There is no data to return anymore
+      return false;
+  }
+
+  void JSONItemSequence::JSONIterator::close(){
+    // Set the Rc to "no more data" and clear the variables
+    theRc = SQLITE_ERROR;
+    if(theColumnCount > 0)
+    {
+      theColumnNamesZString.clear();
+    }
+    theColumnCount = 0;
+    stopPrefetch();
+    if(theStmt != NULL)
+      sqlite3_reset(theStmt);
+    releaseStatement();
+  }
+
+/*******************************************************************************
+ *                                ShardOptions                                 *
+ ******************************************************************************/
+  ShardOptions::ShardOptions()
+    : theDescending(false), thePrefetch(DEFAULT_PREFETCH) {}
+
+  ShardOptions::AGGREGATE
+  ShardOptions::getAggregate(const std::string& aColumn) const
+  {
+    std::map<std::string, AGGREGATE>::const_iterator lIter = theAggregates.find(aColumn);
+    return (lIter == theAggregates.end())?NONE:lIter->second;
+  }
+
+  void
+  ShardOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      std::string lKey = lItemJSONKey.getStringValue().str();
+      Item lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+
+      if (lKey == "order-by")
+      {
+        theOrderBy = lOptionValue.getStringValue().str();
+      }
+      else if (lKey == "descending")
+      {
+        theDescending = lOptionValue.getBooleanValue();
+      }
+      else if (lKey == "params")
+      {
+        theParams = lOptionValue;
+      }
+      else if (lKey == "prefetch")
+      {
+        std::string lValue = lOptionValue.getStringValue().str();
+        char* lEnd;
+        long lDepth = strtol(lValue.c_str(), &lEnd, 10);
+        if(lValue.empty() || *lEnd != '\0' || lDepth < 1 || lDepth > QueryOptions::MAX_PREFETCH)
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      "prefetch: " + lValue).c_str());
+        thePrefetch = (unsigned int)lDepth;
+      }
+      else if (lKey == "aggregate" && lOptionValue.isJSONItem() &&
+               lOptionValue.getJSONItemKind() == store::StoreConsts::jsonObject)
+      {
+        Item lColumn;
+        Iterator_t lIterColumns = lOptionValue.getObjectKeys();
+        lIterColumns->open();
+        while (lIterColumns->next(lColumn))
+        {
+          std::string lFunction =
+            lOptionValue.getObjectValue(lColumn.getStringValue()).getStringValue().str();
+          AGGREGATE lAggregate;
+          if(lFunction == "sum")
+            lAggregate = SUM;
+          else if(lFunction == "count")
+            lAggregate = COUNT;
+          else if(lFunction == "min")
+            lAggregate = MIN;
+          else if(lFunction == "max")
+            lAggregate = MAX;
+          else
+          {
+            lIterColumns->close();
+            SqliteFunction::throwError("UNKNOWN-OPTION",
+                                       (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                        "aggregate: " + lFunction).c_str());
+          }
+          theAggregates[lColumn.getStringValue().str()] = lAggregate;
+        }
+        lIterColumns->close();
+      } else
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lKey).c_str());
+    }
+    lIterKeys->close();
+  }
+
+/*******************************************************************************
+ *                                BackupOptions                                *
+ ******************************************************************************/
+  BackupOptions::BackupOptions()
+    : theDatabase("main"), thePagesPerStep(DEFAULT_PAGES_PER_STEP), theSleep(0),
+      theProgress(false) {}
+
+  void
+  BackupOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      std::string lKey = lItemJSONKey.getStringValue().str();
+      Item lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+
+      if (lKey == "database")
+      {
+        theDatabase = lOptionValue.getStringValue().str();
+      }
+      else if (lKey == "progress")
+      {
+        theProgress = lOptionValue.getBooleanValue();
+      }
+      else if (lKey == "pages-per-step" || lKey == "sleep-ms")
+      {
+        std::string lValue = lOptionValue.getStringValue().str();
+        char* lEnd;
+        long lNumber = strtol(lValue.c_str(), &lEnd, 10);
+        bool lPages = lKey == "pages-per-step";
+        if(lValue.empty() || *lEnd != '\0' || lNumber > INT_MAX ||
+           (lPages?(lNumber == 0 || lNumber < -1):(lNumber < 0)))
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      lKey + ": " + lValue).c_str());
+        if(lPages)
+          thePagesPerStep = (int)lNumber;
+        else
+          theSleep = (int)lNumber;
+      } else
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lKey).c_str());
+    }
+    lIterKeys->close();
+  }
+
+/*******************************************************************************
+ *                               FunctionOptions                               *
+ ******************************************************************************/
+  FunctionOptions::FunctionOptions()
+    : theArity(-1), theDeterministic(false),
+      theMemoSize(UserFunction::DEFAULT_MEMO_SIZE) {}
+
+  void
+  FunctionOptions::setValues(Item& aOptions)
+  {
+    Item lItemJSONKey;
+
+    Iterator_t lIterKeys = aOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      std::string lKey = lItemJSONKey.getStringValue().str();
+      Item lOptionValue = aOptions.getObjectValue(lItemJSONKey.getStringValue());
+
+      if (lKey == "deterministic")
+      {
+        theDeterministic = lOptionValue.getBooleanValue();
+      }
+      else if (lKey == "initial")
+      {
+        theInitial = lOptionValue;
+      }
+      else if (lKey == "arity" || lKey == "memoize")
+      {
+        std::string lValue = lOptionValue.getStringValue().str();
+        char* lEnd;
+        long lNumber = strtol(lValue.c_str(), &lEnd, 10);
+        bool lArity = lKey == "arity";
+        if(lValue.empty() || *lEnd != '\0' || lNumber > INT_MAX ||
+           (lArity?(lNumber < -1 || lNumber > MAX_ARITY):(lNumber < 0)))
+          SqliteFunction::throwError("UNKNOWN-OPTION",
+                                     (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                      lKey + ": " + lValue).c_str());
+        if(lArity)
+          theArity = (int)lNumber;
+        else
+          theMemoSize = (unsigned int)lNumber;
+      } else
+        SqliteFunction::throwError("UNKNOWN-OPTION",
+                                   (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                    lKey).c_str());
+    }
+    lIterKeys->close();
+  }
+
+/*******************************************************************************
+ *                            ShardedItemSequence                              *
+ ******************************************************************************/
+  ShardedItemSequence::~ShardedItemSequence()
+  {
+    for(size_t i=0; i<theShards.size(); i++)
+    {
+      sqlite3_finalize(theShards[i].theStmt);
+      sqlite3_close_v2(theShards[i].theDb);
+    }
+  }
+
+  void
+  ShardedItemSequence::addShard(sqlite3* aDb, sqlite3_stmt* aStmt)
+  {
+    Shard lShard;
+    lShard.theDb = aDb;
+    lShard.theStmt = aStmt;
+    theShards.push_back(lShard);
+  }
+
+  void
+  ShardedItemSequence::init()
+  {
+    if(theShards.empty())
+      return;
+
+    sqlite3_stmt* lFirst = theShards[0].theStmt;
+    int lColumnCount = sqlite3_column_count(lFirst);
+    for(int i=0; i<lColumnCount; i++)
+      theColumns.push_back(sqlite3_column_name(lFirst, i));
+    for(size_t lShard=1; lShard<theShards.size(); lShard++)
+    {
+      sqlite3_stmt* lStmt = theShards[lShard].theStmt;
+      bool lSame = sqlite3_column_count(lStmt) == lColumnCount;
+      for(int i=0; lSame && i<lColumnCount; i++)
+        lSame = theColumns[i] == sqlite3_column_name(lStmt, i);
+      if(!lSame)
+        SqliteFunction::throwError("SHARD-MISMATCH",
+                                   SqliteFunction::getErrorMessage("SHARD-MISMATCH"));
+    }
+
+    size_t lAggregates = 0;
+    for(int i=0; i<lColumnCount; i++)
+    {
+      if(theColumns[i] == theOptions.getOrderBy())
+        theOrderColumn = i;
+      if(theOptions.getAggregate(theColumns[i]) != ShardOptions::NONE)
+        ++lAggregates;
+    }
+    if(!theOptions.getOrderBy().empty() && theOrderColumn < 0)
+      SqliteFunction::throwError("UNKNOWN-OPTION",
+                                 (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                  "order-by: " + theOptions.getOrderBy()).c_str());
+    if(theOptions.hasAggregates() && lAggregates == 0)
+      SqliteFunction::throwError("UNKNOWN-OPTION",
+                                 (std::string(SqliteFunction::getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                                  "aggregate").c_str());
+  }
+
+/*******************************************************************************
+ *                   ShardedItemSequence::ShardedIterator                      *
+ ******************************************************************************/
+  void ShardedItemSequence::ShardedIterator::open(){
+    const std::vector<Shard>& lShards = theSequence->theShards;
+    int lColumnCount = (int)theSequence->theColumns.size();
+
+    theFactory = Zorba::getInstance(0)->getItemFactory();
+    theKeys.clear();
+    for(int i=0; i<lColumnCount; i++)
+      theKeys.push_back(theFactory->createString(theSequence->theColumns[i]));
+
+    // Every shard is stepped on a thread of its own from now on
+    stopBuffers();
+    theRows.assign(lShards.size(), NULL);
+    for(size_t i=0; i<lShards.size(); i++)
+    {
+      sqlite3_reset(lShards[i].theStmt);
+      RowBuffer* lBuffer = new RowBuffer(lShards[i].theStmt, lColumnCount,
+                                         theSequence->theOptions.getPrefetch(), false);
+      theBuffers.push_back(lBuffer);
+      if(!lBuffer->start())
+      {
+        stopBuffers();
+        SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM", "Can't start a shard thread");
+      }
+    }
+    for(size_t i=0; i<lShards.size(); i++)
+      advance(i);
+    theCurrent = 0;
+    theOpen = true;
+
+    theAggregated.clear();
+    theNextAggregated = 0;
+    if(theSequence->theOptions.hasAggregates())
+      aggregate();
+  }
+
+  void ShardedItemSequence::ShardedIterator::stopBuffers(){
+    for(size_t i=0; i<theBuffers.size(); i++)
+    {
+      theBuffers[i]->stop();
+      delete theBuffers[i];
+    }
+    theBuffers.clear();
+    theRows.clear();
+  }
+
+  void ShardedItemSequence::ShardedIterator::advance(size_t aShard){
+    RowBuffer* lBuffer = theBuffers[aShard];
+    if(theRows[aShard] != NULL)
+      lBuffer->pop();
+    theRows[aShard] = lBuffer->front();
+    if(theRows[aShard] == NULL && lBuffer->getRc() != SQLITE_DONE)
+    {
+      std::string lError = lBuffer->getError();
+      stopBuffers();
+      theOpen = false;
+      SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM", lError.c_str());
+    }
+  }
+
+  zorba::Item ShardedItemSequence::ShardedIterator::createRow(const RowBuffer::Value* aRow){
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    for(size_t i=0; i<theKeys.size(); i++)
+      lElements.push_back(std::pair<zorba::Item, zorba::Item>(theKeys[i],
+        RowBuffer::createItem(theFactory, aRow[i])));
+    return theFactory->createJSONObject(lElements);
+  }
+
+  void ShardedItemSequence::ShardedIterator::combine(
+    ShardOptions::AGGREGATE aAggregate,
+    RowBuffer::Value& aResult,
+    const RowBuffer::Value& aValue){
+    // Like in SQL, NULL values don't take part
+    if(aValue.theType == SQLITE_NULL)
+      return;
+    if(aResult.theType == SQLITE_NULL)
+    {
+      aResult = aValue;
+      return;
+    }
+
+    switch(aAggregate){
+    case ShardOptions::SUM:
+    case ShardOptions::COUNT:
+      // The partial counts of the shards are added up
+      if(aResult.theType == SQLITE_INTEGER && aValue.theType == SQLITE_INTEGER)
+        aResult.theInteger += aValue.theInteger;
+      else
+      {
+        double lSum =
+          ((aResult.theType == SQLITE_INTEGER)?(double)aResult.theInteger:
+           (aResult.theType == SQLITE_FLOAT)?aResult.theDouble:
+           strtod(aResult.theBytes.c_str(), NULL)) +
+          ((aValue.theType == SQLITE_INTEGER)?(double)aValue.theInteger:
+           (aValue.theType == SQLITE_FLOAT)?aValue.theDouble:
+           strtod(aValue.theBytes.c_str(), NULL));
+        aResult.theType = SQLITE_FLOAT;
+        aResult.theDouble = lSum;
+      }
+      break;
+    case ShardOptions::MIN:
+      if(RowBuffer::compare(aValue, aResult) < 0)
+        aResult = aValue;
+      break;
+    case ShardOptions::MAX:
+      if(RowBuffer::compare(aValue, aResult) > 0)
+        aResult = aValue;
+      break;
+    default:
+      break;
+    }
+  }
+
+  namespace {
+    // Orders aggregated rows on the "order-by" column
+    class RowLess
+    {
+      private:
+        int theColumn;
+        bool theDescending;
+
+      public:
+        RowLess(int aColumn, bool aDescending)
+          : theColumn(aColumn), theDescending(aDescending) {}
+
+        bool operator()(const std::vector<RowBuffer::Value>* aRow1,
+                        const std::vector<RowBuffer::Value>* aRow2) const
+        {
+          int lCmp = RowBuffer::compare((*aRow1)[theColumn], (*aRow2)[theColumn]);
+          return theDescending?(lCmp > 0):(lCmp < 0);
+        }
+    };
+  }
+
+  void ShardedItemSequence::ShardedIterator::aggregate(){
+    const ShardOptions& lOptions = theSequence->theOptions;
+    size_t lColumnCount = theSequence->theColumns.size();
+    std::vector<ShardOptions::AGGREGATE> lAggregates;
+    for(size_t i=0; i<lColumnCount; i++)
+      lAggregates.push_back(lOptions.getAggregate(theSequence->theColumns[i]));
+
+    // The columns that are not aggregated are the group of a row, the
+    // groups are returned in the order they are first seen
+    std::map<std::string, size_t> lGroups;
+    std::deque<std::vector<RowBuffer::Value> > lResults;
+    for(size_t lShard=0; lShard<theRows.size(); lShard++)
+    {
+      while(theRows[lShard] != NULL)
+      {
+        const RowBuffer::Value* lRow = theRows[lShard];
+        // The type, then the value with its length; numbers are kept as
+        // their bytes so no two values share a key
+        std::string lKey;
+        for(size_t i=0; i<lColumnCount; i++)
+        {
+          if(lAggregates[i] != ShardOptions::NONE)
+            continue;
+          const RowBuffer::Value& lValue = lRow[i];
+          lKey += (char)('0' + lValue.theType);
+          if(lValue.theType == SQLITE_INTEGER)
+            lKey.append((const char*)&lValue.theInteger, sizeof(lValue.theInteger));
+          else if(lValue.theType == SQLITE_FLOAT)
+          {
+            // -0.0 and 0.0 are the same group
+            double lDouble = (lValue.theDouble == 0)?0.0:lValue.theDouble;
+            lKey.append((const char*)&lDouble, sizeof(lDouble));
+          }
+          else if(lValue.theType != SQLITE_NULL)
+          {
+            size_t lSize = lValue.theBytes.size();
+            lKey.append((const char*)&lSize, sizeof(lSize));
+            lKey += lValue.theBytes;
+          }
+        }
+
+        std::map<std::string, size_t>::iterator lGroup = lGroups.find(lKey);
+        if(lGroup == lGroups.end())
+        {
+          lGroups[lKey] = lResults.size();
+          lResults.push_back(std::vector<RowBuffer::Value>(lRow, lRow + lColumnCount));
+        }
+        else
+        {
+          std::vector<RowBuffer::Value>& lResult = lResults[lGroup->second];
+          for(size_t i=0; i<lColumnCount; i++)
+          {
+            if(lAggregates[i] != ShardOptions::NONE)
+              combine(lAggregates[i], lResult[i], lRow[i]);
+          }
+        }
+        advance(lShard);
+      }
+    }
+
+    std::vector<const std::vector<RowBuffer::Value>*> lOrdered;
+    for(size_t i=0; i<lResults.size(); i++)
+      lOrdered.push_back(&lResults[i]);
+    if(theSequence->theOrderColumn >= 0)
+      std::stable_sort(lOrdered.begin(), lOrdered.end(),
+                       RowLess(theSequence->theOrderColumn, lOptions.getDescending()));
+    for(size_t i=0; i<lOrdered.size(); i++)
+      theAggregated.push_back(createRow(&(*lOrdered[i])[0]));
+  }
+
+  bool ShardedItemSequence::ShardedIterator::next(zorba::Item& aItem){
+    if(!theOpen)
+      return false;
+
+    if(theSequence->theOptions.hasAggregates())
+    {
+      if(theNextAggregated >= theAggregated.size())
+        return false;
+      aItem = theAggregated[theNextAggregated++];
+      return true;
+    }
+
+    size_t lShard = theRows.size();
+    if(theSequence->theOrderColumn >= 0)
+    {
+      // Each shard is sorted already, the first row of the shards is merged
+      int lColumn = theSequence->theOrderColumn;
+      bool lDescending = theSequence->theOptions.getDescending();
+      for(size_t i=0; i<theRows.size(); i++)
+      {
+        if(theRows[i] == NULL)
+          continue;
+        if(lShard == theRows.size())
+          lShard = i;
+        else
+        {
+          int lCmp = RowBuffer::compare(theRows[i][lColumn], theRows[lShard][lColumn]);
+          if(lDescending?(lCmp > 0):(lCmp < 0))
+            lShard = i;
+        }
+      }
+    }
+    else
+    {
+      while(theCurrent < theRows.size() && theRows[theCurrent] == NULL)
+        ++theCurrent;
+      lShard = theCurrent;
+    }
+
+    if(lShard == theRows.size())
+      return false;
+    aItem = createRow(theRows[lShard]);
+    advance(lShard);
+    return true;
+  }
+
+  void ShardedItemSequence::ShardedIterator::close(){
+    stopBuffers();
+    theAggregated.clear();
+    theOpen = false;
+  }
+
+/*******************************************************************************
+ *              JSONMetadataItemSequence::JSONMetadataIterator                 *
+ ******************************************************************************/
+#ifdef ZORBA_SQLITE_HAVE_METADATA
+  void JSONMetadataItemSequence::JSONMetadataIterator::open(){
+    // The column origins are known once the statement is prepared, it is
+    // not run
+    if(theStmt != NULL){
+      theFactory = Zorba::getInstance(0)->getItemFactory();
+
+      theColumnCount = sqlite3_column_count(theStmt);
+      if(theColumnCount > 0)
+      {
+        theActualColumn = 0;
+        theRc = SQLITE_ROW;
+      } else
+        theRc = SQLITE_ERROR;
+    } else
+      theRc = SQLITE_ERROR;
+  }
+
+  bool JSONMetadataItemSequence::JSONMetadataIterator::next(zorba::Item& aItem){
+    //zorba::Item aKey;
+    zorba::Item aValue;
+    std::vector<std::pair<zorba::Item, zorba::Item> > elements;
+    sqlite3 *lDbHandle;
+    const char *lDbName;
+    const char *lTableName;
+    const char *lDataType;
+    const char *lCollSequence;
+    const char *lOriginName;
+    int lNotNull, lPrimaryKey, lAutoinc, lRc;
+
+    if(theRc == SQLITE_ROW){
+      // Get the metadata for 'theActualColumn' column
+      // in a key = value fashion
+      lDbHandle = sqlite3_db_handle(theStmt);
+      lDbName = sqlite3_column_database_name(theStmt, theActualColumn);
+      lTableName = sqlite3_column_table_name(theStmt, theActualColumn);
+      lOriginName = sqlite3_column_origin_name(theStmt, theActualColumn);
+      if(lTableName == NULL){
+        // An expression, only its name is known
+        aValue = theFactory->createString(sqlite3_column_name(theStmt, theActualColumn));
+        elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::NAME), aValue));
+        aItem = theFactory->createJSONObject(elements);
+        theActualColumn++;
+        theRc = (theActualColumn >= theColumnCount)?SQLITE_ERROR:SQLITE_ROW;
+        return true;
+      }
+      lRc = sqlite3_table_column_metadata(lDbHandle,
+                                    lDbName,
+                                    lTableName,
+                                    lOriginName,
+                                    &lDataType,
+                                    &lCollSequence,
+                                    &lNotNull,
+                                    &lPrimaryKey,
+                                    &lAutoinc);
+      if(lRc != 0)
+        SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errmsg(lDbHandle));
+      aValue = theFactory->createString(lOriginName);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::NAME), aValue));
+      aValue = theFactory->createString(lDbName);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::DATABASE), aValue));
+      aValue = theFactory->createString(lTableName);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::TABLE), aValue));
+      aValue = theFactory->createString(lDataType);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::TYPE), aValue));
+      aValue = theFactory->createString(lCollSequence);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::COLLATION), aValue));
+      aValue = theFactory->createBoolean((lNotNull==0)?false:true);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::NULLABLE), aValue));
+      aValue = theFactory->createBoolean((lPrimaryKey==0)?false:true);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::PRIMARY_KEY), aValue));
+      aValue = theFactory->createBoolean((lAutoinc==0)?false:true);
+      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::AUTOINC), aValue));
+      aItem = theFactory->createJSONObject(elements);
+      elements.clear();
+      // Get more data if available
+      theActualColumn++;
+      if(theActualColumn >= theColumnCount)
+        theRc = SQLITE_ERROR;
+      else
+        theRc = SQLITE_ROW;
+      return true;
+    } else
+      // There is no data to return anymore
+      return false;
+  }
+
+  void JSONMetadataItemSequence::JSONMetadataIterator::close(){
+    // Set the Rc to "no more data" and clear the variables
+    theRc = SQLITE_ERROR;
+    theColumnCount = 0;
+  }
+#endif
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ConnectFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3 *lSqldb = NULL;
+    ConnMap* lConnMap = getConnectionMap(aDctx);
+    Item lItemName = getOneItem(aArgs, 0);
+    Item lItemOpts;
+    std::string lStrUUID;
+    SqliteOptions lOptions;
+
+    if(aArgs.size() == 2){
+      // add code to include options
+      lItemOpts = getOneItem(aArgs, 1);
+      lOptions.setValues(lItemOpts);
+    }
+
+    // Connect to the specified location with the specified options
+    lSqldb = openDatabase(lItemName.getStringValue().str(), lOptions);
+    // Store the handle for this connection and return it
+    lStrUUID = lConnMap->storeConn(lSqldb);
+    lConnMap->getConnection(lStrUUID)->getStatementCache().setCapacity(
+      lOptions.getStatementCacheSize());
+    lConnMap->getConnection(lStrUUID)->getTimer().setTimeout(lOptions.getTimeout());
+
+    return ItemSequence_t(new SingletonItemSequence(SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    IsConnectedFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3 *lSqldb;
+    ConnMap* lConnMap = getConnectionMap(aDctx);
+    Item lItemRes;
+    Item lItemUUID = getOneItem(aArgs, 0);
+
+    // Look for the UUID into the Connection Map
+    // if it is in there means that you have it connected
+    lSqldb = lConnMap->getConn(lItemUUID.getStringValue().str());
+    if(lSqldb == NULL){
+      lItemRes = SqliteModule::getItemFactory()->createBoolean(false);
+    } else {
+      lItemRes = SqliteModule::getItemFactory()->createBoolean(true);
+    }
+
+    return ItemSequence_t(new SingletonItemSequence(lItemRes));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    CommitFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+
+    lConn->commit();
+
+    return ItemSequence_t(new SingletonItemSequence(lItemUUID));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    RollbackFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+
+    lConn->rollback();
+
+    return ItemSequence_t(new SingletonItemSequence(lItemUUID));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    BeginTransactionFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    Connection::TX_MODE lMode = Connection::TX_DEFERRED;
+
+    if(aArgs.size() == 2){
+      Item lItemMode = getOneItem(aArgs, 1);
+      lMode = Connection::getModeFromString(lItemMode.getStringValue().str());
+    }
+    lConn->beginTransaction(lMode);
+
+    return ItemSequence_t(new SingletonItemSequence(lItemUUID));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    TransactionStateFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createString(
+        Connection::getModeAsString(lConn->getTransactionMode()))));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ExecuteQueryFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  { 
+    sqlite3_stmt *lPstmt;
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemQry = getOneItem(aArgs, 1);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    std::string lQry = lItemQry.getStringValue().str();
+
+    // Reuse the statement compiled for the same SQL text if there is one
+    lPstmt = lConn->getStatementCache().acquire(lQry);
+
+    // Once we got the SQL Query executed just pass it to the JSON Sequence
+    // so it will return what we need to the user
+    std::auto_ptr<JSONItemSequence> lSeq(
+      new JSONItemSequence(lPstmt, &lConn->getStatementCache(), lQry));
+    lSeq->setOptions(getQueryOptions(aArgs, 2, lConn));
+    lSeq->setTimer(&lConn->getTimer());
+    return ItemSequence_t(lSeq.release());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ExecuteUpdateFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemQry = getOneItem(aArgs, 1);
+    Item lItemRes;
+    Item lItemJSONKey;
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    std::string lQry = lItemQry.getStringValue().str();
+
+    // Reuse the statement compiled for the same SQL text if there is one
+    lPstmt = lConn->getStatementCache().acquire(lQry);
+
+    // Once we got the SQL Query executed just pass it to the JSON Sequence
+    // after we get the result we convert it to a integer Item
+    std::auto_ptr<JSONItemSequence> lSeq(
+      new JSONItemSequence(lPstmt, &lConn->getStatementCache(), lQry));
+    lSeq->setTimer(&lConn->getTimer());
+    Iterator_t lIter = lSeq->getIterator();
+    lIter->open();
+    lIter->next(lItemRes);
+    lIter->close();
+    Iterator_t lIterKeys = lItemRes.getObjectKeys();
+    lIterKeys->open();
+    lIterKeys->next(lItemJSONKey);
+    lIterKeys->close();
+    Item lItemValue = lItemRes.getObjectValue(lItemJSONKey.getStringValue());
+    return ItemSequence_t(new SingletonItemSequence(lItemValue));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    MetadataFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+#ifdef ZORBA_SQLITE_HAVE_METADATA
+    sqlite3_stmt *lPstmt;
+    zorba::Item lItemPstmt = getOneItem(aArgs, 0);
+    zorba::Item lVecItem, lJSONKey, lJSONArray, lJSONRes;
+    StmtMap *lStmtMap = getStatementMap(aDctx);
+    std::vector<zorba::Item> lItems;
+    std::vector<std::pair<zorba::Item, zorba::Item> > lVectorRes;
+    ItemFactory* lFactory;
+    Iterator_t lIter;
+
+    lFactory = SqliteModule::getItemFactory();
+    // Get the prepared statement
+    lPstmt = lStmtMap->getStmt(lItemPstmt.getStringValue().str());
+    if(lPstmt == NULL){
+      // No valid prepared statement id passed
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    }
+
+    // Computed once per statement, unless a schema change prepared it again
+    if(lStmtMap->getMetadata(lPstmt, lJSONRes))
+      return ItemSequence_t(new SingletonItemSequence(lJSONRes));
+
+    // So now create a JSONMetadataItemSequence and let it
+    // get us what we need
+    std::auto_ptr<JSONMetadataItemSequence> lSeq(new JSONMetadataItemSequence(lPstmt));
+    lIter = lSeq->getIterator();
+    lIter->open();
+    while(lIter->next(lVecItem))
+    {
+      lItems.push_back(lVecItem);
+    }
+    lIter->close();
+    lJSONArray = lFactory->createJSONArray(lItems);
+    lJSONKey = lFactory->createString(std::string("columns"));
+    lVectorRes.push_back(std::pair<Item, Item>(lJSONKey, lJSONArray));
+    lJSONRes = lFactory->createJSONObject(lVectorRes);
+    lStmtMap->setMetadata(lPstmt, lJSONRes);
+    
+    return ItemSequence_t(new SingletonItemSequence(lJSONRes));
+#else
+    throwError("UNAVAILABLE-METADATA", getErrorMessage("UNAVAILABLE-METADATA"));
+#endif
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    PrepareStatementFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemQry = getOneItem(aArgs, 1);
+    std::string lStrUUID;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+
+    // Create the prepared statement
+    lPstmt = createPreparedStatement(aDctx, lItemUUID.getStringValue().str(),
+      lItemQry.getStringValue().str());
+
+    // Create a new handle for the prepared statement
+    lStrUUID = stmtMap->storeStmt(lPstmt,
+      getConnectionMap(aDctx)->getConnection(lItemUUID.getStringValue().str()));
+
+    return ItemSequence_t(new SingletonItemSequence(SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetValueFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemPos = getOneItem(aArgs, 1);
+    Item lItem = getOneItem(aArgs, 2);
+    int lPos;
+
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+
+    // Same conversion as s:bind, every type it accepts is accepted here
+    lPos = strToInt(lItemPos.getStringValue().str());
+    bindItem(lPstmt, lPos, lItem);
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetBooleanFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemPos = getOneItem(aArgs, 1);
+    Item lItemBool = getOneItem(aArgs, 2);
+
+    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                        strToInt(lItemPos.getStringValue().str()), lItemBool.getBooleanValue());
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetNumericFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemPos = getOneItem(aArgs, 1);
+    Item lItemNumeric = getOneItem(aArgs, 2);
+    int lPos = strToInt(lItemPos.getStringValue().str());
+
+    switch(lItemNumeric.getTypeCode()){
+    case store::XS_BYTE:
+    case store::XS_INT:
+      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                          lPos, lItemNumeric.getIntValue());
+      break;
+    case store::XS_INTEGER:
+      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                          lPos, strToInt(lItemNumeric.getStringValue().str()));
+      break;
+    case store::XS_FLOAT:
+    case store::XS_DOUBLE:
+      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                          lPos, lItemNumeric.getDoubleValue());
+      break;
+    case store::XS_DECIMAL:
+      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                          lPos, strToDouble(lItemNumeric.getStringValue().str()));
+      break;
+    default:
+      throwError("INVALID-VALUE", getErrorMessage("INVALID-VALUE"));
+    }
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetStringFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemPos = getOneItem(aArgs, 1);
+    Item lItemString = getOneItem(aArgs, 2);
+    
+    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                        strToInt(lItemPos.getStringValue().str()), lItemString.getStringValue().str());
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetNullFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemPos = getOneItem(aArgs, 1);
+
+    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
+                        strToInt(lItemPos.getStringValue().str()));
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ClearParamsFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+
+    clearValues(aDctx, lItemUUID.getStringValue().str());
+    return ItemSequence_t(new EmptySequence());
+  }
+  
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ClosePreparedFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  { 
+    sqlite3_stmt *lPstmt;
+    Item lItemUUID = getOneItem(aArgs, 0);
+    StmtMap* stmtMap;
+
+    // get the prepared statement
+    stmtMap = getStatementMap(aDctx);
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+
+    // Once we got the prepared statement just get rid of it
+    stmtMap->deleteStmt(lItemUUID.getStringValue().str());
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ExecuteQueryPreparedFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    Item lItemUUID = getOneItem(aArgs, 0);
+
+    // Get the prepared statement
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+
+    // And let the JSONItemSequence execute it
+    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
+    lSeq->setOptions(getQueryOptions(aArgs, 1,
+      stmtMap->getConnection(lItemUUID.getStringValue().str())));
+    lSeq->setTimer(getTimer(aDctx, lItemUUID.getStringValue().str()));
+    return ItemSequence_t(lSeq.release());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ExecuteUpdatePreparedFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemRes, lItemJSONKey;
+
+    // Get the prepared statement
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+
+    // And let the JSONItemSequence execute it
+    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
+    lSeq->setTimer(getTimer(aDctx, lItemUUID.getStringValue().str()));
+    Iterator_t lIter = lSeq->getIterator();
+    lIter->open();
+    lIter->next(lItemRes);
+    lIter->close();
+    Iterator_t lIterKeys = lItemRes.getObjectKeys();
+    lIterKeys->open();
+    lIterKeys->next(lItemJSONKey);
+    lIterKeys->close();
+    Item lItemValue = lItemRes.getObjectValue(lItemJSONKey.getStringValue());
+    return ItemSequence_t(new SingletonItemSequence(lItemValue));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    BindFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemParams = getOneItem(aArgs, 1);
+
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+
+    // Parameters not given are bound to NULL, as on a new statement
+    sqlite3_reset(lPstmt);
+    sqlite3_clear_bindings(lPstmt);
+    bindParameters(lPstmt, lItemParams, stmtMap);
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ExecuteBatchFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    sqlite3_stmt *lPstmt;
+    sqlite3 *lDb;
+    StmtMap *stmtMap = getStatementMap(aDctx);
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lRow;
+    bool lOwnTransaction = false;
+    sqlite3_int64 lAffectedRows = 0;
+    int lRc;
+
+    // Get the prepared statement
+    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    lDb = sqlite3_db_handle(lPstmt);
+    Connection* lConn = stmtMap->getConnection(lItemUUID.getStringValue().str());
+    if(lConn == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    QueryTimer* lTimer = &lConn->getTimer();
+    sqlite3_int64 lDeadline = lTimer->getDeadline(-1);
+
+    BatchOptions lOptions;
+    if(aArgs.size() == 3){
+      Item lItemOpts = getOneItem(aArgs, 2);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
+
+    // Don't nest into a transaction started by the user
+    lOwnTransaction = lOptions.getTransaction() != Connection::TX_NONE &&
+                      sqlite3_get_autocommit(lDb) != 0;
+    if(lOwnTransaction)
+      lConn->beginTransaction(lOptions.getTransaction());
+    sqlite3_reset(lPstmt);
+    try
+    {
+      Iterator_t lIter = aArgs[1]->getIterator();
+      lIter->open();
+      while(lIter->next(lRow))
+      {
+        sqlite3_clear_bindings(lPstmt);
+        bindParameters(lPstmt, lRow, stmtMap);
+
+        while((lRc = lTimer->step(lPstmt, lDeadline)) == SQLITE_ROW)
+          ;
+        if(lRc != SQLITE_DONE)
+        {
+          std::string lErr = sqlite3_errmsg(lDb);
+          sqlite3_reset(lPstmt);
+          throwStepError(lRc, lErr, lDeadline);
+        }
+        lAffectedRows += sqlite3_changes(lDb);
+        sqlite3_reset(lPstmt);
+      }
+      lIter->close();
+    }
+    catch (...)
+    {
+      sqlite3_reset(lPstmt);
+      if(lOwnTransaction)
+      {
+        sqlite3_exec(lDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+        lConn->getTransactionMode();
+      }
+      throw;
+    }
+    sqlite3_clear_bindings(lPstmt);
+    if(lOwnTransaction)
+      lConn->commit();
+
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createLong(lAffectedRows)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    StatementCacheStatsFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    StatementCache& lCache = lConn->getStatementCache();
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("capacity"),
+      lFactory->createLong(lCache.getCapacity())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("size"),
+      lFactory->createLong(lCache.getSize())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("hits"),
+      lFactory->createLong(lCache.getHits())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("misses"),
+      lFactory->createLong(lCache.getMisses())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("evictions"),
+      lFactory->createLong(lCache.getEvictions())));
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    LiveStatementsFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    StatementCache& lCache = lConn->getStatementCache();
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    unsigned int lLive = lConn->getLiveStatements();
+    unsigned int lPrepared = getStatementMap(aDctx)->getStatementCount(lConn->getDb());
+    unsigned int lKnown = lCache.getSize() + lCache.getInUse() + lPrepared;
+
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("live"),
+      lFactory->createLong(lLive)));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("cached"),
+      lFactory->createLong(lCache.getSize())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("in-use"),
+      lFactory->createLong(lCache.getInUse())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("prepared"),
+      lFactory->createLong(lPrepared)));
+    // Whatever is left was compiled by the module itself (schema pragmas,
+    // scripts, running batches), or by statements of another query
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("internal"),
+      lFactory->createLong((lLive > lKnown)?lLive - lKnown:0)));
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ConnectionSettingsFunction::evaluate(
+    const Arguments_t& aArgs,
+    const zorba::StaticContext* aSctx,
+    const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    SqliteOptions lOptions;
+
+    lOptions.setValues(lConn->getDb());
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("journal-mode"),
+      lFactory->createString(lOptions.getJournalMode())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("synchronous"),
+      lFactory->createString(lOptions.getSynchronous())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("cache-size"),
+      lFactory->createLong(strToLong(lOptions.getCacheSize()))));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("mmap-size"),
+      lFactory->createLong(strToLong(lOptions.getMmapSize()))));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("temp-store"),
+      lFactory->createString(lOptions.getTempStore())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("page-size"),
+      lFactory->createLong(strToLong(lOptions.getPageSize()))));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("locking-mode"),
+      lFactory->createString(lOptions.getLockingMode())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("busy-timeout"),
+      lFactory->createLong(lOptions.getBusyTimeout())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("statement-cache-size"),
+      lFactory->createLong(lConn->getStatementCache().getCapacity())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("timeout-ms"),
+      lFactory->createLong(lConn->getTimer().getTimeout())));
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    ConnectPooledFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    ConnMap* lConnMap = getConnectionMap(aDctx);
+    Item lItemPool = getOneItem(aArgs, 0);
+    Item lItemName = getOneItem(aArgs, 1);
+    std::string lStrUUID;
+    std::string lDbName;
+    SqliteOptions lOptions;
+
+    if(aArgs.size() == 3){
+      Item lItemOpts = getOneItem(aArgs, 2);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
     }
-    return res;
+
+    lDbName = lItemName.getStringValue().str();
+    if(lDbName == "")
+      lDbName = std::string(":memory:");
+
+    // Take an idle connection of the pool (or a new one) and register it
+    // in this query like any other connection; it goes back to the pool
+    // when the query is done
+    ConnectionPool* lPool = ConnectionPool::getPool(
+      lItemPool.getStringValue().str(), lDbName, lOptions);
+    Connection* lConn = lPool->checkout();
+    lStrUUID = lConnMap->storeConnection(lConn);
+
+    return ItemSequence_t(new SingletonItemSequence(SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
   }
 
 /*******************************************************************************
- *                         JSONItemSequence::JSONIterator                      *
  ******************************************************************************/
-  void JSONItemSequence::JSONIterator::open(){
-    zorba::Item lColumnName;
-    char* lColumnNameChar;
-    // Get data and create the column names
-    if(theStmt != NULL){
-      theRc = sqlite3_step(theStmt);
-      SqliteFunction::checkForError((theRc==SQLITE_ROW || theRc==SQLITE_DONE)?0:-1, 0,
-                                    sqlite3_db_handle(theStmt));
-      if(theRc == SQLITE_DONE)
-        isUpdateResult = true;
-      theFactory = Zorba::getInstance(0)->getItemFactory();
+  zorba::ItemSequence_t
+    PoolStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemPool = getOneItem(aArgs, 0);
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    ConnectionPool* lPool = ConnectionPool::findPool(lItemPool.getStringValue().str());
 
-      theColumnCount = sqlite3_column_count(theStmt);
-      if(theColumnCount > 0)
+    if(lPool == NULL)
+      throwError("UNKNOWN-POOL", getErrorMessage("UNKNOWN-POOL"));
+
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("in-use"),
+      lFactory->createLong(lPool->getInUse())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("idle"),
+      lFactory->createLong(lPool->getIdle())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("max-size"),
+      lFactory->createLong(lPool->getMaxSize())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("created"),
+      lFactory->createLong(lPool->getCreated())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("reused"),
+      lFactory->createLong(lPool->getReused())));
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    BlobOpenFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemTable = getOneItem(aArgs, 1);
+    Item lItemColumn = getOneItem(aArgs, 2);
+    Item lItemRowid = getOneItem(aArgs, 3);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    std::string lDatabase = "main";
+    bool lWritable = false;
+
+    if(aArgs.size() > 4)
+    {
+      Item lItemOptions = getOneItem(aArgs, 4);
+      Item lItemJSONKey;
+      Iterator_t lIterKeys = lItemOptions.getObjectKeys();
+      lIterKeys->open();
+      while (lIterKeys->next(lItemJSONKey))
       {
-        for(int i=0; i<theColumnCount; i++)
-        {
-          const char* lpChar = sqlite3_column_name(theStmt, i);
-          int lLen = strlen(lpChar);
-          lColumnNameChar = new char[lLen+1];
-          memcpy(lColumnNameChar, lpChar, lLen);
-          lColumnNameChar[lLen] = '\0';
-          lColumnName = theFactory->createString(lColumnNameChar);
-          theColumnNamesZString.push_back(lColumnName);
-          delete lColumnNameChar;
-        }
+        Item lOptionValue = lItemOptions.getObjectValue(lItemJSONKey.getStringValue());
+        if (lItemJSONKey.getStringValue() == "writable")
+          lWritable = lOptionValue.getBooleanValue();
+        else if (lItemJSONKey.getStringValue() == "database")
+          lDatabase = lOptionValue.getStringValue().str();
+        else
+          throwError("UNKNOWN-OPTION",
+                     (std::string(getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                      lItemJSONKey.getStringValue().str()).c_str());
       }
+      lIterKeys->close();
     }
+
+    Blob* lBlob = new Blob(lConn->getDb(), lDatabase,
+                           lItemTable.getStringValue().str(),
+                           lItemColumn.getStringValue().str(),
+                           strToLong(lItemRowid.getStringValue().str()),
+                           lWritable);
+    std::string lStrUUID = getConnectionMap(aDctx)->storeBlob(
+      lItemUUID.getStringValue().str(), lConn, lBlob);
+
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
   }
 
-  bool JSONItemSequence::JSONIterator::next(zorba::Item& aItem){
-    int aType, aSize;
-    zorba::Item aValue;
-    std::vector<std::pair<zorba::Item, zorba::Item> > elements;
-    const char *aBlobPtr;
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    BlobSizeFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Blob* lBlob = getBlob(aDctx, lItemUUID.getStringValue().str());
 
-    if(theRc == SQLITE_ROW){
-      // get the resulting data from the statement
-      // in a key = value fashion
-      for(int i=0; i<theColumnCount; i++){
-        aType = sqlite3_column_type(theStmt, i);
-        switch(aType){
-        case SQLITE_NULL:
-          aValue = theFactory->createJSONNull();
-          break;
-        case SQLITE_INTEGER: 
-          aValue = theFactory->createInt(sqlite3_column_int(theStmt, i));
-          break;
-        case SQLITE_FLOAT:
-          aValue = theFactory->createDouble(sqlite3_column_double(theStmt, i));
-          break;
-        case SQLITE_BLOB:
-          aSize = sqlite3_column_bytes(theStmt, i);
-          aBlobPtr = (const char *)sqlite3_column_blob(theStmt, i);
-          aValue = theFactory->createBase64Binary(aBlobPtr, aSize, true);
-          break;
-        default:
-          std::string str = std::string((const char *)sqlite3_column_text(theStmt, i));
-          aValue = theFactory->createString(
-            zorba::String(str)
-          );
-        }
-        elements.push_back(std::pair<zorba::Item, zorba::Item>(theColumnNamesZString.at(i), aValue));
-      }
-      aItem = theFactory->createJSONObject(elements);
-      elements.clear();
-      // Get more data if available
-      theRc = sqlite3_step(theStmt);
-      return true;
-    } else if(isUpdateResult && theRc == SQLITE_DONE){
-      // we have a prepared statement that represents a UPDATE and it's already executed
-      aValue = theFactory->createInt(sqlite3_changes(sqlite3_db_handle(theStmt)));
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::AFFECTED_ROWS), aValue));
-      aItem = theFactory->createJSONObject(elements);
-      elements.clear();
-      // be sure it won't be back in here
-      theRc = SQLITE_ERROR;
-      return true;
-    } else
-      // There is no data to return anymore
-      return false;
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createLong(lBlob->getSize())));
   }
 
-  void JSONItemSequence::JSONIterator::close(){
-    // Set the Rc to "no more data" and clear the variables
-    theRc = SQLITE_ERROR;
-    if(theColumnCount > 0)
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    BlobReadFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Blob* lBlob = getBlob(aDctx, lItemUUID.getStringValue().str());
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+
+    if(aArgs.size() == 1)
     {
-      theColumnNamesZString.clear();
+      // The whole value is streamed, only one chunk is in memory at a time
+      std::auto_ptr<BlobStream> lStream(new BlobStream(lBlob->openReader()));
+      Item lResult = lFactory->createStreamableBase64Binary(*lStream, &BlobStream::release);
+      lStream.release();
+      return ItemSequence_t(new SingletonItemSequence(lResult));
     }
-    theColumnCount = 0;
-    if(theStmt != NULL)
-      sqlite3_reset(theStmt);
+
+    sqlite3_int64 lOffset = strToLong(getOneItem(aArgs, 1).getStringValue().str());
+    sqlite3_int64 lLength = strToLong(getOneItem(aArgs, 2).getStringValue().str());
+    checkBlobRange(lBlob, lOffset, lLength);
+
+    std::vector<char> lBuffer((size_t)lLength + 1);
+    checkForError(lBlob->read(&lBuffer[0], (int)lLength, (int)lOffset), 0,
+                  lBlob->getDb());
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createBase64Binary(&lBuffer[0], (size_t)lLength, false)));
   }
 
 /*******************************************************************************
- *              JSONMetadataItemSequence::JSONMetadataIterator                 *
  ******************************************************************************/
-#ifdef ZORBA_SQLITE_HAVE_METADATA
-  void JSONMetadataItemSequence::JSONMetadataIterator::open(){
-    // Get data and create the column names
-    if(theStmt != NULL){
-      theRc = sqlite3_step(theStmt);
-      SqliteFunction::checkForError((theRc==SQLITE_ROW || theRc==SQLITE_DONE)?0:-1, 0,
-                                    sqlite3_db_handle(theStmt));
-      theFactory = Zorba::getInstance(0)->getItemFactory();
+  zorba::ItemSequence_t
+    BlobWriteFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemData = getOneItem(aArgs, 1);
+    sqlite3_int64 lOffset = strToLong(getOneItem(aArgs, 2).getStringValue().str());
+    Blob* lBlob = getBlob(aDctx, lItemUUID.getStringValue().str());
 
-      theColumnCount = sqlite3_column_count(theStmt);
-      if(theColumnCount > 0)
+    if(!lItemData.isStreamable())
+    {
+      size_t lSize;
+      const char* lData = lItemData.getBase64BinaryValue(lSize);
+      std::vector<char> lDecoded;
+      if(lItemData.isEncoded() && lSize > 0)
       {
-        theActualColumn = 0;
-        theRc = SQLITE_ROW;
-      } else
-        theRc = SQLITE_ERROR;
-    } else
-      theRc = SQLITE_ERROR;
-  }
-
-  bool JSONMetadataItemSequence::JSONMetadataIterator::next(zorba::Item& aItem){
-    //zorba::Item aKey;
-    zorba::Item aValue;
-    std::vector<std::pair<zorba::Item, zorba::Item> > elements;
-    sqlite3 *lDbHandle;
-    const char *lDbName;
-    const char *lTableName;
-    const char *lDataType;
-    const char *lCollSequence;
-    const char *lOriginName;
-    int lNotNull, lPrimaryKey, lAutoinc, lRc;
+        lDecoded.resize(base64::decoded_size(lSize));
+        lSize = base64::decode(lData, lSize, &lDecoded[0]);
+        lData = &lDecoded[0];
+      }
+      checkBlobRange(lBlob, lOffset, lSize);
+      checkForError(lBlob->write(lData, (int)lSize, (int)lOffset), 0, lBlob->getDb());
+      return ItemSequence_t(new EmptySequence());
+    }
 
-    if(theRc == SQLITE_ROW){
-      // Get the metadata for 'theActualColumn' column
-      // in a key = value fashion
-      lDbHandle = sqlite3_db_handle(theStmt);
-      lDbName = sqlite3_column_database_name(theStmt, theActualColumn);
-      lTableName = sqlite3_column_table_name(theStmt, theActualColumn);
-      lOriginName = sqlite3_column_origin_name(theStmt, theActualColumn);
-      lRc = sqlite3_table_column_metadata(lDbHandle,
-                                    lDbName,
-                                    lTableName,
-                                    lOriginName,
-                                    &lDataType,
-                                    &lCollSequence,
-                                    &lNotNull,
-                                    &lPrimaryKey,
-                                    &lAutoinc);
-      if(lRc != 0)
-        SqliteFunction::throwError(0, sqlite3_errmsg(lDbHandle));
-      aValue = theFactory->createString(lOriginName);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::NAME), aValue));
-      aValue = theFactory->createString(lDbName);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::DATABASE), aValue));
-      aValue = theFactory->createString(lTableName);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::TABLE), aValue));
-      aValue = theFactory->createString(lDataType);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::TYPE), aValue));
-      aValue = theFactory->createString(lCollSequence);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::COLLATION), aValue));
-      aValue = theFactory->createBoolean((lNotNull==0)?false:true);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::NULLABLE), aValue));
-      aValue = theFactory->createBoolean((lPrimaryKey==0)?false:true);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::PRIMARY_KEY), aValue));
-      aValue = theFactory->createBoolean((lAutoinc==0)?false:true);
-      elements.push_back(std::pair<zorba::Item, zorba::Item>(SqliteModule::getGlobalKey(SqliteModule::AUTOINC), aValue));
-      aItem = theFactory->createJSONObject(elements);
-      elements.clear();
-      // Get more data if available
-      theActualColumn++;
-      if(theActualColumn >= theColumnCount)
-        theRc = SQLITE_ERROR;
+    // Streamed values are copied one chunk at a time
+    std::istream& lStream = lItemData.getStream();
+    bool lEncoded = lItemData.isEncoded();
+    std::vector<char> lChunk(Blob::CHUNK_SIZE);
+    std::vector<char> lDecoded;
+    while(lStream)
+    {
+      size_t lSize = 0;
+      if(lEncoded)
+      {
+        // The chunk size is a multiple of 4 so only whole groups of
+        // characters are decoded, line breaks are skipped
+        char lChar;
+        while(lSize < lChunk.size() && lStream.get(lChar))
+        {
+          if(!isspace((unsigned char)lChar))
+            lChunk[lSize++] = lChar;
+        }
+        if(lSize == 0)
+          break;
+        lDecoded.resize(base64::decoded_size(lSize));
+        lSize = base64::decode(&lChunk[0], lSize, &lDecoded[0]);
+      }
       else
-        theRc = SQLITE_ROW;
-      return true;
-    } else
-      // There is no data to return anymore
-      return false;
-  }
-
-  void JSONMetadataItemSequence::JSONMetadataIterator::close(){
-    // Set the Rc to "no more data" and clear the variables
-    theRc = SQLITE_ERROR;
-    theColumnCount = 0;
-    if(theStmt != NULL)
-      sqlite3_reset(theStmt);
+      {
+        lStream.read(&lChunk[0], lChunk.size());
+        lSize = (size_t)lStream.gcount();
+        if(lSize == 0)
+          break;
+      }
+      checkBlobRange(lBlob, lOffset, lSize);
+      checkForError(lBlob->write(lEncoded?&lDecoded[0]:&lChunk[0], (int)lSize,
+                                 (int)lOffset), 0, lBlob->getDb());
+      lOffset += lSize;
+    }
+    return ItemSequence_t(new EmptySequence());
   }
-#endif
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ConnectFunction::evaluate(
+    BlobCloseFunction::evaluate(
       const Arguments_t& aArgs,
       const zorba::StaticContext* aSctx,
       const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3 *lSqldb = NULL;
-    int lRc;
-    ConnMap* lConnMap = getConnectionMap(aDctx);
-    Item lItemName = getOneItem(aArgs, 0);
-    Item lItemOpts;
-    std::string lStrUUID;
-    std::string lDbName;
-    SqliteOptions lOptions;
+    Item lItemUUID = getOneItem(aArgs, 0);
+    if(!getConnectionMap(aDctx)->closeBlob(lItemUUID.getStringValue().str()))
+      throwError("INVALID-BLOB", getErrorMessage("INVALID-BLOB"));
+    return ItemSequence_t(new EmptySequence());
+  }
+
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    SetTraceFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemOptions = getOneItem(aArgs, 1);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    bool lProfile = true, lRows = true, lReset = false;
+    sqlite3_int64 lSlowMillis = 0;
+    std::string lSlowLog;
 
-    if(aArgs.size() == 2){
-      // add code to include options
-      lItemOpts = getOneItem(aArgs, 1);
-      lOptions.setValues(lItemOpts);
+    // The callback may run on a prefetching thread, it holds the connection's
+    // mutex while it does
+    sqlite3_mutex* lDbMutex = sqlite3_db_mutex(lConn->getDb());
+    if(lItemOptions.isNull())
+    {
+      sqlite3_mutex_enter(lDbMutex);
+      lConn->getTrace().disable();
+      sqlite3_mutex_leave(lDbMutex);
+      return ItemSequence_t(new EmptySequence());
     }
 
-    // Connect to the specified location with the specified options
-    lDbName = lItemName.getStringValue().str();
-    if(lDbName == "")
-      lDbName = std::string(":memory:");
+    Item lItemJSONKey;
+    Iterator_t lIterKeys = lItemOptions.getObjectKeys();
+    lIterKeys->open();
+    while (lIterKeys->next(lItemJSONKey))
+    {
+      Item lOptionValue = lItemOptions.getObjectValue(lItemJSONKey.getStringValue());
+      if (lItemJSONKey.getStringValue() == "profile")
+        lProfile = lOptionValue.getBooleanValue();
+      else if (lItemJSONKey.getStringValue() == "rows")
+        lRows = lOptionValue.getBooleanValue();
+      else if (lItemJSONKey.getStringValue() == "reset")
+        lReset = lOptionValue.getBooleanValue();
+      else if (lItemJSONKey.getStringValue() == "slow-query-ms")
+        lSlowMillis = strToLong(lOptionValue.getStringValue().str());
+      else if (lItemJSONKey.getStringValue() == "slow-query-log")
+        lSlowLog = lOptionValue.getStringValue().str();
+      else
+        throwError("UNKNOWN-OPTION",
+                   (std::string(getErrorMessage("UNKNOWN-OPTION")) + " - " +
+                    lItemJSONKey.getStringValue().str()).c_str());
+    }
+    lIterKeys->close();
 
 #ifndef SQLITE_WITH_FILE_ACCESS
-    if (lDbName != ":memory:") {
+    if (!lSlowLog.empty()) {
       throwError("COMPILED-WITHOUT-DISK-ACCESS",
                  getErrorMessage("COMPILED-WITHOUT-DISK-ACCESS"));
     }
 #endif /* not SQLITE_WITH_FILE_ACCESS */
-    lRc = sqlite3_open_v2(lDbName.c_str(), &lSqldb, lOptions.getOptionsAsInt(), NULL);
-    // Store the UUID for this connection and return it
-    lStrUUID = createUUID();
-    lConnMap->storeConn(lStrUUID, lSqldb);
-    if(lRc == SQLITE_CANTOPEN)
-      throwError("CANT-OPEN-DB", getErrorMessage("CANT-OPEN-DB"));
-    else
-      checkForError(lRc, 0, lSqldb);
-
-    return ItemSequence_t(new SingletonItemSequence(SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
+    sqlite3_mutex_enter(lDbMutex);
+    try
+    {
+      if(lReset)
+        lConn->getTrace().reset();
+      lConn->getTrace().enable(lProfile, lRows, lSlowMillis, lSlowLog);
+    }
+    catch (...)
+    {
+      sqlite3_mutex_leave(lDbMutex);
+      throw;
+    }
+    sqlite3_mutex_leave(lDbMutex);
+    return ItemSequence_t(new EmptySequence());
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    IsConnectedFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    TraceStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3 *lSqldb;
-    ConnMap* lConnMap = getConnectionMap(aDctx);
-    Item lItemRes;
     Item lItemUUID = getOneItem(aArgs, 0);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    // The callback may run on a prefetching thread, it holds the connection's
+    // mutex while it does
+    sqlite3_mutex* lDbMutex = sqlite3_db_mutex(lConn->getDb());
+    sqlite3_mutex_enter(lDbMutex);
+    TraceStats::Entries_t lEntries = lConn->getTrace().getEntries();
+    sqlite3_mutex_leave(lDbMutex);
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    std::multimap<sqlite3_int64, Item> lSorted;
 
-    // Look for the UUID into the Connection Map
-    // if it is in there means that you have it connected
-    lSqldb = lConnMap->getConn(lItemUUID.getStringValue().str());
-    if(lSqldb == NULL){
-      lItemRes = SqliteModule::getItemFactory()->createBoolean(false);
-    } else {
-      lItemRes = SqliteModule::getItemFactory()->createBoolean(true);
+    for(TraceStats::Entries_t::const_iterator lIter = lEntries.begin();
+        lIter != lEntries.end(); ++lIter)
+    {
+      const TraceStats::Entry& lEntry = lIter->second;
+      std::vector<std::pair<zorba::Item, zorba::Item> > lStats;
+      lStats.push_back(std::pair<Item, Item>(lFactory->createString("sql"),
+        lFactory->createString(lIter->first)));
+      lStats.push_back(std::pair<Item, Item>(lFactory->createString("calls"),
+        lFactory->createLong(lEntry.theCalls)));
+      lStats.push_back(std::pair<Item, Item>(lFactory->createString("total-ns"),
+        lFactory->createLong(lEntry.theTotalNanos)));
+      lStats.push_back(std::pair<Item, Item>(lFactory->createString("max-ns"),
+        lFactory->createLong(lEntry.theMaxNanos)));
+      lStats.push_back(std::pair<Item, Item>(lFactory->createString("rows"),
+        lFactory->createLong(lEntry.theRows)));
+      lSorted.insert(std::pair<sqlite3_int64, Item>(lEntry.theTotalNanos,
+        lFactory->createJSONObject(lStats)));
     }
 
-    return ItemSequence_t(new SingletonItemSequence(lItemRes));
+    // The most expensive statements first
+    std::vector<Item> lStatements;
+    for(std::multimap<sqlite3_int64, Item>::reverse_iterator lIter = lSorted.rbegin();
+        lIter != lSorted.rend(); ++lIter)
+      lStatements.push_back(lIter->second);
+
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("enabled"),
+      lFactory->createBoolean(lConn->getTrace().isEnabled())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("slow-queries"),
+      lFactory->createLong(lConn->getTrace().getSlowQueries())));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("statements"),
+      lFactory->createJSONArray(lStatements)));
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    CommitFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    StatementStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3 *lDb;
+    static const struct { const char* theName; int theOp; } lCounters[] = {
+      { "fullscan-steps", SQLITE_STMTSTATUS_FULLSCAN_STEP },
+      { "sorts", SQLITE_STMTSTATUS_SORT },
+      { "autoindexes", SQLITE_STMTSTATUS_AUTOINDEX },
+      { "vm-steps", SQLITE_STMTSTATUS_VM_STEP },
+      { "reprepares", SQLITE_STMTSTATUS_REPREPARE },
+      { "runs", SQLITE_STMTSTATUS_RUN },
+      { "memory-used", SQLITE_STMTSTATUS_MEMUSED }
+    };
     Item lItemUUID = getOneItem(aArgs, 0);
-    ConnMap* lConnMap = getConnectionMap(aDctx);
+    sqlite3_stmt* lPstmt = getStatementMap(aDctx)->getStmt(lItemUUID.getStringValue().str());
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    bool lReset = false;
 
-    lDb = lConnMap->getConn(lItemUUID.getStringValue().str());
-    if(lDb == NULL)
-      throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
+    if(lPstmt == NULL)
+      throwError("INVALID-PREPARED-STATEMENT",
+                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    if(aArgs.size() > 1)
+      lReset = getOneItem(aArgs, 1).getBooleanValue();
 
-    return ItemSequence_t(new SingletonItemSequence(lItemUUID));
+    for(size_t i=0; i<sizeof(lCounters)/sizeof(lCounters[0]); i++)
+    {
+      // The memory used is a size, not a counter that can be reset
+      int lValue = sqlite3_stmt_status(lPstmt, lCounters[i].theOp,
+        (lReset && lCounters[i].theOp != SQLITE_STMTSTATUS_MEMUSED)?1:0);
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString(lCounters[i].theName),
+        lFactory->createLong(lValue)));
+    }
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    RollbackFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    ConnectionStatsFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3 *lDb;
+    static const struct { const char* theName; int theOp; bool theHighwater; } lCounters[] = {
+      { "cache-hits", SQLITE_DBSTATUS_CACHE_HIT, false },
+      { "cache-misses", SQLITE_DBSTATUS_CACHE_MISS, false },
+      { "cache-writes", SQLITE_DBSTATUS_CACHE_WRITE, false },
+      { "cache-used", SQLITE_DBSTATUS_CACHE_USED, false },
+      { "schema-used", SQLITE_DBSTATUS_SCHEMA_USED, false },
+      { "statements-used", SQLITE_DBSTATUS_STMT_USED, false },
+      // the high-water mark is read before a reset clears it
+      { "lookaside-max-used", SQLITE_DBSTATUS_LOOKASIDE_USED, true },
+      { "lookaside-used", SQLITE_DBSTATUS_LOOKASIDE_USED, false },
+      { "lookaside-hits", SQLITE_DBSTATUS_LOOKASIDE_HIT, true },
+      { "lookaside-misses-size", SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, true },
+      { "lookaside-misses-full", SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, true }
+    };
     Item lItemUUID = getOneItem(aArgs, 0);
-    ConnMap* lConnMap = getConnectionMap(aDctx);
+    sqlite3* lDb = getConnection(aDctx, lItemUUID.getStringValue().str())->getDb();
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    bool lReset = false;
 
-    lDb = lConnMap->getConn(lItemUUID.getStringValue().str());
-    if(lDb == NULL)
-      throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
+    if(aArgs.size() > 1)
+      lReset = getOneItem(aArgs, 1).getBooleanValue();
 
-    return ItemSequence_t(new SingletonItemSequence(lItemUUID));
+    for(size_t i=0; i<sizeof(lCounters)/sizeof(lCounters[0]); i++)
+    {
+      int lCurrent = 0, lHighwater = 0;
+      checkForError(sqlite3_db_status(lDb, lCounters[i].theOp, &lCurrent, &lHighwater,
+                                      lReset?1:0), 0, lDb);
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString(lCounters[i].theName),
+        lFactory->createLong(lCounters[i].theHighwater?lHighwater:lCurrent)));
+    }
+
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
+  bool
+  ExplainFunction::isFullScan(const std::string& aDetail)
+  {
+    // "SCAN t" (or "SCAN TABLE t" before SQLite 3.36) reads every row,
+    // "SCAN t USING [COVERING] INDEX i" and SEARCH use an index
+    return aDetail.compare(0, 5, "SCAN ") == 0 &&
+           aDetail.find(" USING ") == std::string::npos &&
+           aDetail != "SCAN CONSTANT ROW";
+  }
+
   zorba::ItemSequence_t
-    ExecuteQueryFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
-  { 
-    sqlite3_stmt *lPstmt;
+    ExplainFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
     Item lItemUUID = getOneItem(aArgs, 0);
     Item lItemQry = getOneItem(aArgs, 1);
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    std::string lStrUUID;
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<int> lIds, lParents;
+    std::vector<std::string> lDetails;
+    int lRc;
 
-    // Create the prepared statement with the UUID and Query passed
-    lPstmt = createPreparedStatement(aDctx, lItemUUID.getStringValue().str(),
-      lItemQry.getStringValue().str());
-    lStrUUID = createUUID();
-    stmtMap->storeStmt(lStrUUID, lPstmt);
+    sqlite3_stmt* lPstmt = createPreparedStatement(aDctx,
+      lItemUUID.getStringValue().str(),
+      "EXPLAIN QUERY PLAN " + lItemQry.getStringValue().str());
+    while((lRc = sqlite3_step(lPstmt)) == SQLITE_ROW)
+    {
+      const char* lDetail = (const char*)sqlite3_column_text(lPstmt, 3);
+      lIds.push_back(sqlite3_column_int(lPstmt, 0));
+      lParents.push_back(sqlite3_column_int(lPstmt, 1));
+      lDetails.push_back(lDetail?lDetail:"");
+    }
+    if(lRc != SQLITE_DONE)
+    {
+      std::string lErr = sqlite3_errmsg(sqlite3_db_handle(lPstmt));
+      sqlite3_finalize(lPstmt);
+      throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
+    }
+    sqlite3_finalize(lPstmt);
 
-    // Once we got the SQL Query executed just pass it to the JSON Sequence
-    // so it will return what we need to the user
-    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
-    return ItemSequence_t(lSeq.release());
+    // Children come after their parent, so the tree is built from the last
+    // node up; every list of children is built in reverse order
+    std::map<int, std::vector<Item> > lChildren;
+    for(size_t i=lIds.size(); i-- > 0; )
+    {
+      std::vector<Item> lNodeChildren(lChildren[lIds[i]].rbegin(),
+                                      lChildren[lIds[i]].rend());
+      lChildren.erase(lIds[i]);
+      std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("id"),
+        lFactory->createLong(lIds[i])));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("parent"),
+        lFactory->createLong(lParents[i])));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("detail"),
+        lFactory->createString(lDetails[i])));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("full-scan"),
+        lFactory->createBoolean(isFullScan(lDetails[i]))));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("children"),
+        lFactory->createJSONArray(lNodeChildren)));
+      lChildren[lParents[i]].push_back(lFactory->createJSONObject(lElements));
+    }
+
+    std::vector<Item> lRoots(lChildren[0].rbegin(), lChildren[0].rend());
+    return ItemSequence_t(new VectorItemSequence(lRoots));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ExecuteUpdateFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    ExecuteAsyncFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3_stmt *lPstmt;
     Item lItemUUID = getOneItem(aArgs, 0);
     Item lItemQry = getOneItem(aArgs, 1);
-    Item lItemRes;
-    Item lItemJSONKey;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    std::string lStrUUID;
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    std::string lQry = lItemQry.getStringValue().str();
+    AsyncExecutor* lExecutor = AsyncExecutor::getInstance();
 
-    // Create the prepared statement with the UUID and Query passed
-    lPstmt = createPreparedStatement(aDctx, lItemUUID.getStringValue().str(),
-      lItemQry.getStringValue().str());
-    lStrUUID = createUUID();
-    stmtMap->storeStmt(lStrUUID, lPstmt);
+    // Jobs on a database file read through a connection of their own so they
+    // run in parallel, in-memory databases only exist on the caller's one
+    const char* lFile = sqlite3_db_filename(lConn->getDb(), "main");
+    std::string lPath = (lFile == NULL)?"":lFile;
+    sqlite3* lDb = lConn->getDb();
+    if(!lPath.empty())
+    {
+      lDb = lExecutor->takeConnection(lPath);
+      if(lDb == NULL)
+        throwError("CANT-OPEN-DB", getErrorMessage("CANT-OPEN-DB"));
+    }
 
-    // Once we got the SQL Query executed just pass it to the JSON Sequence
-    // after we get the result we convert it to a integer Item
-    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
-    Iterator_t lIter = lSeq->getIterator();
-    lIter->open();
-    lIter->next(lItemRes);
-    lIter->close();
-    Iterator_t lIterKeys = lItemRes.getObjectKeys();
-    lIterKeys->open();
-    lIterKeys->next(lItemJSONKey);
-    lIterKeys->close();
-    Item lItemValue = lItemRes.getObjectValue(lItemJSONKey.getStringValue());
-    return ItemSequence_t(new SingletonItemSequence(lItemValue));
+    sqlite3_stmt* lStmt = NULL;
+    try
+    {
+      lStmt = prepareStatement(lDb, lQry);
+      if(aArgs.size() > 2)
+      {
+        Item lItemParams = getOneItem(aArgs, 2);
+        if(!lItemParams.isNull())
+          bindParameters(lStmt, lItemParams, NULL);
+      }
+    }
+    catch (...)
+    {
+      sqlite3_finalize(lStmt);
+      if(!lPath.empty())
+        lExecutor->returnConnection(lPath, lDb);
+      throw;
+    }
+
+    AsyncJob* lJob = new AsyncJob(lStmt, lPath);
+    std::string lHandle = getAsyncMap(aDctx)->storeJob(lJob);
+    if(lPath.empty() && (sqlite3_db_mutex(lDb) == NULL || lConn->hasFunctions()))
+    {
+      // A connection opened without a mutex can't be used by a worker, nor
+      // one whose functions call back into the query
+      lJob->execute();
+      lJob->theState = AsyncJob::DONE;
+    }
+    else
+      lExecutor->submit(lJob);
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createAnyURI(lHandle)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    MetadataFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    AwaitFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-#ifdef ZORBA_SQLITE_HAVE_METADATA
-    sqlite3_stmt *lPstmt;
-    zorba::Item lItemPstmt = getOneItem(aArgs, 0);
-    zorba::Item lVecItem, lJSONKey, lJSONArray, lJSONRes;
-    StmtMap *lStmtMap = getStatementMap(aDctx);
-    std::vector<zorba::Item> lItems;
-    std::vector<std::pair<zorba::Item, zorba::Item> > lVectorRes;
-    ItemFactory* lFactory;
-    Iterator_t lIter;
-
-    lFactory = SqliteModule::getItemFactory();
-    // Get the prepared statement
-    lPstmt = lStmtMap->getStmt(lItemPstmt.getStringValue().str());
-    if(lPstmt == NULL){
-      // No valid prepared statement id passed
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
-    }
-
-    // So now create a JSONMetadataItemSequence and let it
-    // get us what we need
-    std::auto_ptr<JSONMetadataItemSequence> lSeq(new JSONMetadataItemSequence(lPstmt));
-    lIter = lSeq->getIterator();
-    lIter->open();
-    while(lIter->next(lVecItem))
-    {
-      lItems.push_back(lVecItem);
-    }
-    lIter->close();
-    lJSONArray = lFactory->createJSONArray(lItems);
-    lJSONKey = lFactory->createString(std::string("columns"));
-    lVectorRes.push_back(std::pair<Item, Item>(lJSONKey, lJSONArray));
-    lJSONRes = lFactory->createJSONObject(lVectorRes);
-    
-    return ItemSequence_t(new SingletonItemSequence(lJSONRes));
-#else
-    throwError("UNAVAILABLE-METADATA", getErrorMessage("UNAVAILABLE-METADATA"));
-#endif
+    Item lItemHandle = getOneItem(aArgs, 0);
+    std::vector<Item> lRows;
+    awaitJob(aDctx, lItemHandle.getStringValue().str(), lRows);
+    return ItemSequence_t(new VectorItemSequence(lRows));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    PrepareStatementFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    AwaitAnyFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3_stmt *lPstmt;
-    Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemQry = getOneItem(aArgs, 1);
-    std::string lStrUUID;
-    StmtMap *stmtMap = getStatementMap(aDctx);
+    AsyncMap* lAsyncMap = getAsyncMap(aDctx);
+    std::vector<std::string> lHandles;
+    std::vector<AsyncJob*> lJobs;
+    Item lItemHandle;
 
-    // Create the prepared statement
-    lPstmt = createPreparedStatement(aDctx, lItemUUID.getStringValue().str(),
-      lItemQry.getStringValue().str());
+    Iterator_t lIter = aArgs[0]->getIterator();
+    lIter->open();
+    while(lIter->next(lItemHandle))
+    {
+      std::string lHandle = lItemHandle.getStringValue().str();
+      AsyncJob* lJob = lAsyncMap->getJob(lHandle);
+      if(lJob == NULL)
+      {
+        lIter->close();
+        throwError("INVALID-ASYNC-HANDLE", getErrorMessage("INVALID-ASYNC-HANDLE"));
+      }
+      lHandles.push_back(lHandle);
+      lJobs.push_back(lJob);
+    }
+    lIter->close();
+    if(lJobs.empty())
+      return ItemSequence_t(new EmptySequence());
 
-    // Create a new UUID for the prepared statement
-    lStrUUID = SqliteFunction::createUUID();
-    stmtMap->storeStmt(lStrUUID, lPstmt);
+    size_t lFirst = AsyncExecutor::getInstance()->waitAny(lJobs);
+    std::vector<Item> lRows;
+    awaitJob(aDctx, lHandles[lFirst], lRows);
 
-    return ItemSequence_t(new SingletonItemSequence(SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("handle"),
+      lFactory->createAnyURI(lHandles[lFirst])));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("rows"),
+      lFactory->createJSONArray(lRows)));
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    SetValueFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    ExecuteShardedFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemPos = getOneItem(aArgs, 1);
-    Item lItem = getOneItem(aArgs, 2);
-    int lPos;
+    Item lItemQry = getOneItem(aArgs, 1);
+    std::string lQry = lItemQry.getStringValue().str();
+    ShardOptions lOptions;
+    if(aArgs.size() > 2)
+    {
+      Item lItemOpts = getOneItem(aArgs, 2);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
 
-    lPos = strToInt(lItemPos.getStringValue().str());
-    switch(lItem.getTypeCode()){
-    case store::XS_BOOLEAN:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItem.getBooleanValue());
-      break;
-    case store::XS_BYTE:
-    case store::XS_INT:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItem.getIntValue());
-      break;
-    case store::XS_INTEGER:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, strToInt(lItem.getStringValue().str()));
-      break;
-    case store::XS_FLOAT:
-    case store::XS_DOUBLE:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItem.getDoubleValue());
-      break;
-    case store::XS_DECIMAL:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, strToDouble(lItem.getStringValue().str()));
-      break;
-    case store::XS_STRING:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItem.getStringValue().str());
-      break;
-    default:
-      throwError("INVALID-VALUE", getErrorMessage("INVALID-VALUE"));
+    // The shards are only read, they must exist already
+    SqliteOptions lDbOptions;
+    lDbOptions.setOpenReadOnly(true);
+    lDbOptions.setOpenCreate(false);
+
+    std::auto_ptr<ShardedItemSequence> lSeq(new ShardedItemSequence(lOptions));
+    Item lItemPath;
+    Iterator_t lIter = aArgs[0]->getIterator();
+    lIter->open();
+    while(lIter->next(lItemPath))
+    {
+      sqlite3* lDb = openDatabase(lItemPath.getStringValue().str(), lDbOptions);
+      sqlite3_stmt* lStmt = NULL;
+      try
+      {
+        lStmt = prepareStatement(lDb, lQry);
+        if(!lOptions.getParams().isNull())
+          bindParameters(lStmt, lOptions.getParams(), NULL);
+      }
+      catch (...)
+      {
+        sqlite3_finalize(lStmt);
+        sqlite3_close(lDb);
+        lIter->close();
+        throw;
+      }
+      lSeq->addShard(lDb, lStmt);
     }
-    return ItemSequence_t(new EmptySequence());
+    lIter->close();
+    lSeq->init();
+    return ItemSequence_t(lSeq.release());
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    SetBooleanFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    TableInfoFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
     Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemPos = getOneItem(aArgs, 1);
-    Item lItemBool = getOneItem(aArgs, 2);
+    Item lItemTable = getOneItem(aArgs, 1);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
 
-    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                        strToInt(lItemPos.getStringValue().str()), lItemBool.getBooleanValue());
-    return ItemSequence_t(new EmptySequence());
+    const TableInfo* lInfo = lConn->getSchema().getTable(
+      lItemTable.getStringValue().str());
+    if(lInfo == NULL)
+      return ItemSequence_t(new EmptySequence());
+
+    std::vector<Item> lColumns;
+    for(size_t i=0; i<lInfo->theColumns.size(); i++)
+    {
+      const TableInfo::Column& lColumn = lInfo->theColumns[i];
+      std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("name"),
+        lFactory->createString(lColumn.theName)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("type"),
+        lFactory->createString(lColumn.theType)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("not-null"),
+        lFactory->createBoolean(lColumn.theNotNull)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("default"),
+        lColumn.theHasDefault?lFactory->createString(lColumn.theDefault):
+                              lFactory->createJSONNull()));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("primary-key"),
+        lFactory->createInt(lColumn.thePrimaryKey)));
+      lColumns.push_back(lFactory->createJSONObject(lElements));
+    }
+
+    std::vector<Item> lIndexes;
+    for(size_t i=0; i<lInfo->theIndexes.size(); i++)
+    {
+      const TableInfo::Index& lIndex = lInfo->theIndexes[i];
+      std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+      std::vector<Item> lIndexColumns;
+      for(size_t j=0; j<lIndex.theColumns.size(); j++)
+        lIndexColumns.push_back(lIndex.theColumns[j].empty()?
+          lFactory->createJSONNull():lFactory->createString(lIndex.theColumns[j]));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("name"),
+        lFactory->createString(lIndex.theName)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("unique"),
+        lFactory->createBoolean(lIndex.theUnique)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("origin"),
+        lFactory->createString(lIndex.theOrigin)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("partial"),
+        lFactory->createBoolean(lIndex.thePartial)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("columns"),
+        lFactory->createJSONArray(lIndexColumns)));
+      lIndexes.push_back(lFactory->createJSONObject(lElements));
+    }
+
+    std::vector<Item> lForeignKeys;
+    for(size_t i=0; i<lInfo->theForeignKeys.size(); i++)
+    {
+      const TableInfo::ForeignKey& lKey = lInfo->theForeignKeys[i];
+      std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+      std::vector<Item> lFrom, lTo;
+      for(size_t j=0; j<lKey.theFrom.size(); j++)
+      {
+        lFrom.push_back(lFactory->createString(lKey.theFrom[j]));
+        // No column when the key refers to the primary key
+        lTo.push_back(lKey.theTo[j].empty()?
+          lFactory->createJSONNull():lFactory->createString(lKey.theTo[j]));
+      }
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("table"),
+        lFactory->createString(lKey.theTable)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("from"),
+        lFactory->createJSONArray(lFrom)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("to"),
+        lFactory->createJSONArray(lTo)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("on-update"),
+        lFactory->createString(lKey.theOnUpdate)));
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("on-delete"),
+        lFactory->createString(lKey.theOnDelete)));
+      lForeignKeys.push_back(lFactory->createJSONObject(lElements));
+    }
+
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("name"),
+      lFactory->createString(lInfo->theName)));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("columns"),
+      lFactory->createJSONArray(lColumns)));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("indexes"),
+      lFactory->createJSONArray(lIndexes)));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("foreign-keys"),
+      lFactory->createJSONArray(lForeignKeys)));
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    SetNumericFunction::evaluate(
+    ExecuteScriptFunction::evaluate(
     const Arguments_t& aArgs,
     const zorba::StaticContext* aSctx,
     const zorba::DynamicContext* aDctx) const 
   {
     Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemPos = getOneItem(aArgs, 1);
-    Item lItemNumeric = getOneItem(aArgs, 2);
-    int lPos = strToInt(lItemPos.getStringValue().str());
+    Item lItemSql = getOneItem(aArgs, 1);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    sqlite3* lDb = lConn->getDb();
+    ScriptCache& lCache = lConn->getScriptCache();
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::string lSql = lItemSql.getStringValue().str();
+    ScriptCache::Script_t lScript;
+    std::vector<Item> lChanges;
+    BatchOptions lOptions;
 
-    switch(lItemNumeric.getTypeCode()){
-    case store::XS_BYTE:
-    case store::XS_INT:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItemNumeric.getIntValue());
-      break;
-    case store::XS_INTEGER:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, strToInt(lItemNumeric.getStringValue().str()));
-      break;
-    case store::XS_FLOAT:
-    case store::XS_DOUBLE:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, lItemNumeric.getDoubleValue());
-      break;
-    case store::XS_DECIMAL:
-      setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                          lPos, strToDouble(lItemNumeric.getStringValue().str()));
-      break;
-    default:
-      throwError("INVALID-VALUE", getErrorMessage("INVALID-VALUE"));
+    if(aArgs.size() == 3){
+      Item lItemOpts = getOneItem(aArgs, 2);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
     }
-    return ItemSequence_t(new EmptySequence());
+    // Don't nest into a transaction started by the user
+    bool lOwnTransaction = lOptions.getTransaction() != Connection::TX_NONE &&
+                           sqlite3_get_autocommit(lDb) != 0;
+
+    bool lCached = lCache.acquire(lSql, lScript);
+    sqlite3_int64 lDeadline = lConn->getTimer().getDeadline(-1);
+    const char* lTail = lSql.c_str();
+    const char* lEnd = lTail + lSql.size();
+    size_t lNext = 0;
+
+    if(lOwnTransaction)
+      lConn->beginTransaction(lOptions.getTransaction());
+    try
+    {
+      while(true)
+      {
+        sqlite3_stmt* lStmt;
+        if(lCached)
+        {
+          if(lNext == lScript.size())
+            break;
+          lStmt = lScript[lNext++];
+        }
+        else
+        {
+          // A statement can only be prepared once the ones before it ran,
+          // it may use a table they create
+          if(lTail >= lEnd)
+            break;
+          lStmt = prepareStatement(lDb, lTail, (int)(lEnd - lTail), &lTail);
+          if(lStmt == NULL)
+            continue;
+          lScript.push_back(lStmt);
+        }
+
+        int lTotal = sqlite3_total_changes(lDb);
+        int lRc;
+        while((lRc = lConn->getTimer().step(lStmt, lDeadline)) == SQLITE_ROW)
+          ;
+        if(lRc != SQLITE_DONE)
+        {
+          std::string lErr = sqlite3_errmsg(lDb);
+          throwStepError(lRc, lErr, lDeadline);
+        }
+        // sqlite3_changes() keeps the count of the last INSERT, UPDATE or
+        // DELETE, whatever ran after it
+        lChanges.push_back(lFactory->createLong(
+          sqlite3_total_changes(lDb) == lTotal?0:sqlite3_changes(lDb)));
+        sqlite3_reset(lStmt);
+      }
+    }
+    catch (...)
+    {
+      for(size_t i=0; i<lScript.size(); i++)
+        sqlite3_finalize(lScript[i]);
+      if(lOwnTransaction)
+      {
+        sqlite3_exec(lDb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+        lConn->getTransactionMode();
+      }
+      throw;
+    }
+    lCache.release(lSql, lScript);
+    if(lOwnTransaction)
+      lConn->commit();
+
+    return ItemSequence_t(new VectorItemSequence(lChanges));
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    SetStringFunction::evaluate(
+    InterruptFunction::evaluate(
     const Arguments_t& aArgs,
     const zorba::StaticContext* aSctx,
     const zorba::DynamicContext* aDctx) const 
   {
     Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemPos = getOneItem(aArgs, 1);
-    Item lItemString = getOneItem(aArgs, 2);
-    
-    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                        strToInt(lItemPos.getStringValue().str()), lItemString.getStringValue().str());
+    std::string lHandle = lItemUUID.getStringValue().str();
+
+    // sqlite3_interrupt() may be called from any thread, the statements of
+    // the connection are stepped by another one when they are read ahead
+    Connection* lConn = getConnectionMap(aDctx)->getConnection(lHandle);
+    if(lConn != NULL)
+    {
+      sqlite3_interrupt(lConn->getDb());
+      return ItemSequence_t(new EmptySequence());
+    }
+    AsyncJob* lJob = getAsyncMap(aDctx)->getJob(lHandle);
+    if(lJob != NULL)
+    {
+      AsyncExecutor::getInstance()->interrupt(lJob);
+      return ItemSequence_t(new EmptySequence());
+    }
+    throwError("INVALID-SQLITE-OBJECT", getErrorMessage("INVALID-SQLITE-OBJECT"));
     return ItemSequence_t(new EmptySequence());
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    SetNullFunction::evaluate(
+    BackupFunction::evaluate(
     const Arguments_t& aArgs,
     const zorba::StaticContext* aSctx,
     const zorba::DynamicContext* aDctx) const 
   {
     Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemPos = getOneItem(aArgs, 1);
+    Item lItemDest = getOneItem(aArgs, 1);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    ItemFactory* lFactory = SqliteModule::getItemFactory();
+    std::string lDest = lItemDest.getStringValue().str();
+    BackupOptions lOptions;
 
-    setValueToStatement(aDctx, lItemUUID.getStringValue().str(),
-                        strToInt(lItemPos.getStringValue().str()));
-    return ItemSequence_t(new EmptySequence());
+    if(aArgs.size() == 3){
+      Item lItemOpts = getOneItem(aArgs, 2);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
+
+    // Another connection of the query is overwritten, e.g. a :memory: one
+    // kept as an in-memory replica; anything else is a database file
+    Connection* lDestConn = getConnectionMap(aDctx)->getConnection(lDest);
+    sqlite3* lDestDb;
+    if(lDestConn != NULL)
+      lDestDb = lDestConn->getDb();
+    else
+    {
+      SqliteOptions lDestOptions;
+      lDestDb = openDatabase(lDest, lDestOptions);
+    }
+
+    sqlite3_backup* lBackup = sqlite3_backup_init(lDestDb, "main", lConn->getDb(),
+                                                  lOptions.getDatabase().c_str());
+    if(lBackup == NULL)
+    {
+      std::string lErr = sqlite3_errmsg(lDestDb);
+      if(lDestConn == NULL)
+        sqlite3_close(lDestDb);
+      throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
+    }
+
+    // The source is only locked while a step copies its pages, writers get
+    // their turn in between
+    std::vector<Item> lProgress;
+    int lSteps = 0;
+    int lRetries = 0;
+    int lRc;
+    for(;;)
+    {
+      lRc = sqlite3_backup_step(lBackup, lOptions.getPagesPerStep());
+      ++lSteps;
+      if(lOptions.getProgress())
+      {
+        std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+        lElements.push_back(std::pair<Item, Item>(lFactory->createString("remaining"),
+          lFactory->createLong(sqlite3_backup_remaining(lBackup))));
+        lElements.push_back(std::pair<Item, Item>(lFactory->createString("pagecount"),
+          lFactory->createLong(sqlite3_backup_pagecount(lBackup))));
+        lProgress.push_back(lFactory->createJSONObject(lElements));
+      }
+      if(lRc == SQLITE_OK)
+      {
+        lRetries = 0;
+        if(lOptions.getSleep() > 0)
+          sqlite3_sleep(lOptions.getSleep());
+      }
+      else if((lRc == SQLITE_BUSY || lRc == SQLITE_LOCKED) && ++lRetries <= BackupOptions::BUSY_RETRIES)
+        sqlite3_sleep((lOptions.getSleep() > BackupOptions::BUSY_SLEEP)?
+                      lOptions.getSleep():(int)BackupOptions::BUSY_SLEEP);
+      else
+        break;
+    }
+    int lPageCount = sqlite3_backup_pagecount(lBackup);
+    int lFinishRc = sqlite3_backup_finish(lBackup);
+
+    std::string lErr = (lRc == SQLITE_DONE)?"":sqlite3_errstr(lRc);
+    if(lRc == SQLITE_DONE && lFinishRc != SQLITE_OK)
+      lErr = sqlite3_errmsg(lDestDb);
+    if(lDestConn == NULL)
+      sqlite3_close_v2(lDestDb);
+    if(!lErr.empty())
+      throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
+
+    std::vector<std::pair<zorba::Item, zorba::Item> > lElements;
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("pagecount"),
+      lFactory->createLong(lPageCount)));
+    lElements.push_back(std::pair<Item, Item>(lFactory->createString("steps"),
+      lFactory->createLong(lSteps)));
+    if(lOptions.getProgress())
+      lElements.push_back(std::pair<Item, Item>(lFactory->createString("progress"),
+        lFactory->createJSONArray(lProgress)));
+    return ItemSequence_t(new SingletonItemSequence(
+      lFactory->createJSONObject(lElements)));
+  }
+
+#ifdef ZORBA_SQLITE_HAVE_SERIALIZE
+  namespace {
+    // Makes room for aNeeded bytes in an image allocated by SQLite, at least
+    // one chunk and twice the size each time it grows
+    unsigned char*
+    reserveImage(unsigned char* aImage, sqlite3_uint64& aCapacity,
+                 sqlite3_uint64 aNeeded)
+    {
+      if(aImage != NULL && aNeeded <= aCapacity)
+        return aImage;
+      sqlite3_uint64 lCapacity = (aCapacity == 0)?(sqlite3_uint64)Blob::CHUNK_SIZE:aCapacity;
+      while(lCapacity < aNeeded)
+        lCapacity *= 2;
+      unsigned char* lImage = (unsigned char*)sqlite3_realloc64(aImage, lCapacity);
+      if(lImage == NULL)
+        SqliteFunction::throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errstr(SQLITE_NOMEM));
+      aCapacity = lCapacity;
+      return lImage;
+    }
   }
+#endif /* ZORBA_SQLITE_HAVE_SERIALIZE */
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ClearParamsFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    ConnectFromBinaryFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    Item lItemUUID = getOneItem(aArgs, 0);
+#ifdef ZORBA_SQLITE_HAVE_SERIALIZE
+    ConnMap* lConnMap = getConnectionMap(aDctx);
+    Item lItemData = getOneItem(aArgs, 0);
+    SqliteOptions lOptions;
+    int lRc;
 
-    clearValues(aDctx, lItemUUID.getStringValue().str());
+    if(aArgs.size() == 2){
+      Item lItemOpts = getOneItem(aArgs, 1);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
+    // The image is made read-only, not the in-memory database it goes to
+    bool lReadOnly = lOptions.getOpenReadOnly();
+    lOptions.setOpenReadOnly(false);
+    lOptions.setOpenCreate(true);
+
+    // The image is copied (or decoded) once, into memory SQLite takes over.
+    // Streamed values are read one chunk at a time straight into it
+    unsigned char* lImage = NULL;
+    sqlite3_uint64 lCapacity = 0;
+    sqlite3_uint64 lImageSize = 0;
+    bool lEncoded = lItemData.isEncoded();
+    try
+    {
+      if(lItemData.isStreamable())
+      {
+        std::istream& lStream = lItemData.getStream();
+        std::vector<char> lChunk(lEncoded?Blob::CHUNK_SIZE:0);
+        while(lStream)
+        {
+          if(lEncoded)
+          {
+            // The chunk size is a multiple of 4 so only whole groups of
+            // characters are decoded, line breaks are skipped
+            size_t lSize = 0;
+            char lChar;
+            while(lSize < lChunk.size() && lStream.get(lChar))
+            {
+              if(!isspace((unsigned char)lChar))
+                lChunk[lSize++] = lChar;
+            }
+            if(lSize == 0)
+              break;
+            lImage = reserveImage(lImage, lCapacity,
+                                  lImageSize + base64::decoded_size(lSize));
+            lImageSize += base64::decode(&lChunk[0], lSize, (char*)lImage + lImageSize);
+          }
+          else
+          {
+            lImage = reserveImage(lImage, lCapacity, lImageSize + Blob::CHUNK_SIZE);
+            lStream.read((char*)lImage + lImageSize, Blob::CHUNK_SIZE);
+            lImageSize += (sqlite3_uint64)lStream.gcount();
+          }
+        }
+        // An empty stream still gives SQLite a buffer to own
+        lImage = reserveImage(lImage, lCapacity, 1);
+      }
+      else
+      {
+        size_t lSize = 0;
+        const char* lData = lItemData.getBase64BinaryValue(lSize);
+        lEncoded = lEncoded && lSize > 0;
+        // The size is known, nothing is allocated beyond it
+        lCapacity = lEncoded?base64::decoded_size(lSize):lSize;
+        lImage = (unsigned char*)sqlite3_malloc64((lCapacity > 0)?lCapacity:1);
+        if(lImage == NULL)
+          throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errstr(SQLITE_NOMEM));
+        if(lEncoded)
+          lImageSize = base64::decode(lData, lSize, (char*)lImage);
+        else
+        {
+          memcpy(lImage, lData, lSize);
+          lImageSize = lSize;
+        }
+      }
+    }
+    catch (...)
+    {
+      sqlite3_free(lImage);
+      throw;
+    }
+
+    sqlite3* lDb = NULL;
+    lRc = sqlite3_open_v2(":memory:", &lDb, lOptions.getOptionsAsInt(), NULL);
+    if(lRc != SQLITE_OK)
+    {
+      std::string lErr = (lDb != NULL)?sqlite3_errmsg(lDb):sqlite3_errstr(lRc);
+      sqlite3_close(lDb);
+      sqlite3_free(lImage);
+      throwError("INTERNAL-SQLITE-PROBLEM", lErr.c_str());
+    }
+    // SQLite frees the image once it is closed, or right away on failure
+    lRc = sqlite3_deserialize(lDb, "main", lImage, lImageSize, lCapacity,
+                              SQLITE_DESERIALIZE_FREEONCLOSE |
+                              (lReadOnly?SQLITE_DESERIALIZE_READONLY:
+                                         SQLITE_DESERIALIZE_RESIZEABLE));
+    // The image is only read when used, a bad one is caught here
+    if(lRc == SQLITE_OK)
+      lRc = sqlite3_exec(lDb, "SELECT count(*) FROM sqlite_master", NULL, NULL, NULL);
+    if(lRc != SQLITE_OK)
+    {
+      std::string lErr = getErrorMessage("CANT-OPEN-DB");
+      lErr += "; ";
+      lErr += sqlite3_errmsg(lDb);
+      sqlite3_close(lDb);
+      throwError("CANT-OPEN-DB", lErr.c_str());
+    }
+    try
+    {
+      lOptions.applyPragmas(lDb);
+    }
+    catch (...)
+    {
+      sqlite3_close(lDb);
+      throw;
+    }
+
+    std::string lStrUUID = lConnMap->storeConn(lDb);
+    Connection* lConn = lConnMap->getConnection(lStrUUID);
+    lConn->getStatementCache().setCapacity(lOptions.getStatementCacheSize());
+    lConn->getTimer().setTimeout(lOptions.getTimeout());
+
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createAnyURI(lStrUUID)));
+#else
+    throwError("UNAVAILABLE-SERIALIZE", getErrorMessage("UNAVAILABLE-SERIALIZE"));
     return ItemSequence_t(new EmptySequence());
+#endif
   }
-  
+
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ClosePreparedFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
-  { 
-    sqlite3_stmt *lPstmt;
+    SerializeFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+#ifdef ZORBA_SQLITE_HAVE_SERIALIZE
     Item lItemUUID = getOneItem(aArgs, 0);
-    StmtMap* stmtMap;
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    sqlite3_int64 lSize = 0;
 
-    // get the prepared statement
-    stmtMap = getStatementMap(aDctx);
-    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
-    if(lPstmt == NULL)
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    // An in-memory database made by s:connect-from-binary is one block
+    // already, the item copies it directly
+    unsigned char* lImage = sqlite3_serialize(lConn->getDb(), "main", &lSize,
+                                              SQLITE_SERIALIZE_NOCOPY);
+    bool lCopied = false;
+    if(lImage == NULL)
+    {
+      lImage = sqlite3_serialize(lConn->getDb(), "main", &lSize, 0);
+      if(lImage == NULL && lSize != 0)
+        throwError("INTERNAL-SQLITE-PROBLEM", sqlite3_errmsg(lConn->getDb()));
+      lCopied = true;
+    }
 
-    // Once we got the prepared statement just get rid of it
-    stmtMap->deleteStmt(lItemUUID.getStringValue().str());
+    Item lResult = SqliteModule::getItemFactory()->createBase64Binary(
+      (lImage == NULL)?"":(const char*)lImage, (size_t)lSize, false);
+    if(lCopied)
+      sqlite3_free(lImage);
+    return ItemSequence_t(new SingletonItemSequence(lResult));
+#else
+    throwError("UNAVAILABLE-SERIALIZE", getErrorMessage("UNAVAILABLE-SERIALIZE"));
     return ItemSequence_t(new EmptySequence());
+#endif
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ExecuteQueryPreparedFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    RegisterFunctionFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
     Item lItemUUID = getOneItem(aArgs, 0);
+    Item lItemName = getOneItem(aArgs, 1);
+    Item lItemFunction = getOneItem(aArgs, 2);
+    Connection* lConn = getConnection(aDctx, lItemUUID.getStringValue().str());
+    std::string lName = lItemName.getStringValue().str();
+    // The aggregate form takes the final function before the options
+    bool lAggregate = aArgs.size() > 4;
 
-    // Get the prepared statement
-    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
-    if(lPstmt == NULL)
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    FunctionOptions lOptions;
+    if((int)aArgs.size() > (lAggregate?4:3))
+    {
+      Item lItemOpts = getOneItem(aArgs, lAggregate?4:3);
+      if(!lItemOpts.isNull())
+        lOptions.setValues(lItemOpts);
+    }
 
-    // And let the JSONItemSequence execute it
-    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
-    return ItemSequence_t(lSeq.release());
+    UserFunction* lFunction;
+    if(lAggregate)
+    {
+      UserFunction::Sequence_t lInitial;
+      if(!lOptions.getInitial().isNull())
+        lInitial.push_back(lOptions.getInitial());
+      lFunction = new UserFunction(lItemFunction, getOneItem(aArgs, 3), lInitial);
+    }
+    else
+      lFunction = new UserFunction(lItemFunction, lOptions.getMemoSize());
+
+    // SQLite may only compute a deterministic function once per statement
+    // and allows it in indexes and generated columns
+    int lFlags = SQLITE_UTF8;
+#ifdef SQLITE_DETERMINISTIC
+    if(lOptions.getDeterministic())
+      lFlags |= SQLITE_DETERMINISTIC;
+#endif
+    // lFunction is destroyed by SQLite, even when the registration fails
+    int lRc;
+    if(lAggregate)
+      lRc = sqlite3_create_function_v2(lConn->getDb(), lName.c_str(),
+                                       lOptions.getArity(), lFlags, lFunction,
+                                       NULL, &UserFunction::callStep,
+                                       &UserFunction::callFinal,
+                                       &UserFunction::destroy);
+    else
+      lRc = sqlite3_create_function_v2(lConn->getDb(), lName.c_str(),
+                                       lOptions.getArity(), lFlags, lFunction,
+                                       &UserFunction::callScalar, NULL, NULL,
+                                       &UserFunction::destroy);
+    checkForError(lRc, 0, lConn->getDb());
+    lConn->addFunction(lName, lOptions.getArity());
+    return ItemSequence_t(new EmptySequence());
   }
 
 /*******************************************************************************
  ******************************************************************************/
   zorba::ItemSequence_t
-    ExecuteUpdatePreparedFunction::evaluate(
-    const Arguments_t& aArgs,
-    const zorba::StaticContext* aSctx,
-    const zorba::DynamicContext* aDctx) const 
+    ClosePoolFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
   {
-    sqlite3_stmt *lPstmt;
-    StmtMap *stmtMap = getStatementMap(aDctx);
-    Item lItemUUID = getOneItem(aArgs, 0);
-    Item lItemRes, lItemJSONKey;
-
-    // Get the prepared statement
-    lPstmt = stmtMap->getStmt(lItemUUID.getStringValue().str());
-    if(lPstmt == NULL)
-      throwError("INVALID-PREPARED-STATEMENT",
-                 getErrorMessage("INVALID-PREPARED-STATEMENT"));
+    Item lItemPool = getOneItem(aArgs, 0);
+    bool lClosed = ConnectionPool::closePool(lItemPool.getStringValue().str());
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createBoolean(lClosed)));
+  }
 
-    // And let the JSONItemSequence execute it
-    std::auto_ptr<JSONItemSequence> lSeq(new JSONItemSequence(lPstmt));
-    Iterator_t lIter = lSeq->getIterator();
-    lIter->open();
-    lIter->next(lItemRes);
-    lIter->close();
-    Iterator_t lIterKeys = lItemRes.getObjectKeys();
-    lIterKeys->open();
-    lIterKeys->next(lItemJSONKey);
-    lIterKeys->close();
-    Item lItemValue = lItemRes.getObjectValue(lItemJSONKey.getStringValue());
-    return ItemSequence_t(new SingletonItemSequence(lItemValue));
+/*******************************************************************************
+ ******************************************************************************/
+  zorba::ItemSequence_t
+    InterruptPoolFunction::evaluate(
+      const Arguments_t& aArgs,
+      const zorba::StaticContext* aSctx,
+      const zorba::DynamicContext* aDctx) const 
+  {
+    Item lItemPool = getOneItem(aArgs, 0);
+    bool lFound = ConnectionPool::interruptPool(lItemPool.getStringValue().str());
+    return ItemSequence_t(new SingletonItemSequence(
+      SqliteModule::getItemFactory()->createBoolean(lFound)));
   }
 
+/*******************************************************************************
+ * Process-wide state of the module, released when the library is unloaded.
+ * Defined last so it goes before the statics it uses.
+ ******************************************************************************/
+  class ModuleState
+  {
+    public:
+      ~ModuleState()
+      {
+        AsyncExecutor::shutdown();
+        ConnectionPool::closeAll();
+      }
+  };
+
+  static ModuleState theModuleState;
+
 } /* namespace zorba */ } /* namespace archive*/
 
 #ifdef WIN32
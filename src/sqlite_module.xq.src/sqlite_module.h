@@ -14,54 +14,607 @@
  * limitations under the License.
  */
 
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <list>
 #include <map>
 #include <set>
+#include <streambuf>
+#include <string>
 
 #include <zorba/zorba.h>
 #include <zorba/item_factory.h>
 #include <zorba/external_module.h>
 #include <zorba/function.h>
+#include <zorba/xquery.h>
 #include <vector>
 #include <sqlite3.h>
 
+#include "sqlite_handles.h"
+#include "sqlite_threads.h"
+
 namespace zorba { namespace sqlite {
 
+  class Connection;
+  class ConnectionPool;
+  class SqliteOptions;
+
 /*******************************************************************************
  ******************************************************************************/
   class StmtMap : public ExternalFunctionParameter
   {
     private:
-      typedef std::map<std::string, sqlite3_stmt *> StmtMap_t;
-      StmtMap_t* stmtMap;
+      // The connection is kept with the statement, it is found without a
+      // search through the connections
+      class Entry
+      {
+        public:
+          sqlite3_stmt* theStmt;
+          Connection* theConnection;
+
+          Entry(sqlite3_stmt* aStmt, Connection* aConn)
+            : theStmt(aStmt), theConnection(aConn) {}
+      };
+
+      typedef std::map<std::string, int> ParamIndex_t;
+      typedef std::map<sqlite3_stmt *, ParamIndex_t> ParamIndexMap_t;
+      typedef std::map<sqlite3 *, std::set<std::string> > ConnStmts_t;
+      typedef std::map<sqlite3_stmt *, std::pair<int, zorba::Item> > Metadata_t;
+      HandleTable<Entry> theStatements;
+      ConnStmts_t theConnStmts;         // handles of each connection
+      ParamIndexMap_t theParamIndexes;  // parameter name -> position
+      Metadata_t theMetadata;           // s:metadata result and the number
+                                        // of re-prepares it is valid for
+      Mutex theMutex;                   // guards the maps above
     
     public:
       StmtMap();
       virtual ~StmtMap();
-      bool 
-        storeStmt(const std::string&, sqlite3_stmt *sql);
+      std::string
+        storeStmt(sqlite3_stmt *sql, Connection* aConn);
       sqlite3_stmt*
         getStmt(const std::string&);
+      Connection*
+        getConnection(const std::string&);
+      unsigned int
+        getStatementCount(sqlite3* aDb);
       bool 
         deleteStmt(const std::string&);
+      int
+        getParameterIndex(sqlite3_stmt* aStmt, const std::string& aName);
+      // False if the metadata was not computed since the statement was last
+      // prepared again (after a schema change)
+      bool
+        getMetadata(sqlite3_stmt* aStmt, zorba::Item& aMetadata);
+      void
+        setMetadata(sqlite3_stmt* aStmt, const zorba::Item& aMetadata);
       virtual void 
         destroy() throw();
       void deleteAllForConn(sqlite3* c);
   };
   
+  class StatementCache
+  {
+    public:
+      enum { DEFAULT_CAPACITY = 16 };
+
+    private:
+      typedef std::list<std::pair<std::string, sqlite3_stmt *> > Entries_t;
+      typedef std::map<std::string, Entries_t::iterator> Index_t;
+      sqlite3* theDb;
+      Entries_t theEntries;     // most recently used first
+      Index_t theIndex;
+      unsigned int theCapacity;
+      unsigned int theInUse;    // acquired and not yet released
+      sqlite3_int64 theHits;
+      sqlite3_int64 theMisses;
+      sqlite3_int64 theEvictions;
+      Mutex theMutex;           // results may be read on other threads
+
+      // The caller holds theMutex
+      void
+        evict(unsigned int aSize);
+
+    public:
+      StatementCache(sqlite3* aDb);
+      ~StatementCache();
+      sqlite3_stmt*
+        acquire(const std::string& aSql);
+      void
+        release(const std::string& aSql, sqlite3_stmt* aStmt);
+      void
+        clear();
+      void
+        setCapacity(unsigned int aCapacity);
+      unsigned int
+        getCapacity() const { return theCapacity; }
+      unsigned int
+        getSize() const { return theIndex.size(); }
+      unsigned int
+        getInUse() const { return theInUse; }
+      sqlite3_int64
+        getHits() const { return theHits; }
+      sqlite3_int64
+        getMisses() const { return theMisses; }
+      sqlite3_int64
+        getEvictions() const { return theEvictions; }
+  };
+
+  // The statements of a script prepared once and kept for the next runs
+  class ScriptCache
+  {
+    public:
+      enum { DEFAULT_CAPACITY = 8 };
+      typedef std::vector<sqlite3_stmt *> Script_t;
+
+    private:
+      typedef std::list<std::pair<std::string, Script_t> > Entries_t;
+      typedef std::map<std::string, Entries_t::iterator> Index_t;
+      Entries_t theEntries;     // most recently used first
+      Index_t theIndex;
+      unsigned int theCapacity;
+      Mutex theMutex;
+
+      static void
+        finalize(Script_t& aScript);
+
+    public:
+      ScriptCache() : theCapacity(DEFAULT_CAPACITY) {}
+      ~ScriptCache();
+      // Moves the statements of aSql into aScript, false if they are not
+      // cached and the script has to be prepared statement by statement
+      bool
+        acquire(const std::string& aSql, Script_t& aScript);
+      void
+        release(const std::string& aSql, Script_t& aScript);
+      void
+        clear();
+  };
+
+  class Blob
+  {
+    public:
+      enum { CHUNK_SIZE = 65536 };
+
+    private:
+      sqlite3* theDb;
+      std::string theDatabase;
+      std::string theTable;
+      std::string theColumn;
+      sqlite3_int64 theRowid;
+      bool theWritable;
+      sqlite3_blob* theBlob;
+
+      // Not copyable
+      Blob(const Blob&);
+      Blob& operator=(const Blob&);
+
+    public:
+      Blob(sqlite3* aDb,
+           const std::string& aDatabase,
+           const std::string& aTable,
+           const std::string& aColumn,
+           sqlite3_int64 aRowid,
+           bool aWritable);
+      ~Blob();
+
+      sqlite3*
+        getDb() const { return theDb; }
+      int
+        getSize() const { return sqlite3_blob_bytes(theBlob); }
+      bool
+        isWritable() const { return theWritable; }
+      int
+        read(char* aBuffer, int aLength, int aOffset);
+      int
+        write(const char* aBuffer, int aLength, int aOffset);
+      // A read-only handle on the same value, owned by the caller
+      Blob*
+        openReader() const;
+  };
+
+  // Reads a blob one chunk at a time through a handle of its own, so the
+  // value can be consumed after the handle given to the query is closed
+  class BlobStreamBuf : public std::streambuf
+  {
+    private:
+      Blob* theBlob;
+      int theOffset;
+      char theBuffer[Blob::CHUNK_SIZE];
+
+    protected:
+      virtual int_type
+        underflow();
+
+    public:
+      BlobStreamBuf(Blob* aBlob) : theBlob(aBlob), theOffset(0) {}
+      virtual ~BlobStreamBuf() { delete theBlob; }
+  };
+
+  class BlobStream : public std::istream
+  {
+    private:
+      BlobStreamBuf theBuf;
+
+    public:
+      // A failed read is rethrown to the consumer instead of looking like
+      // the end of the value
+      BlobStream(Blob* aBlob) : std::istream(NULL), theBuf(aBlob)
+      {
+        rdbuf(&theBuf);
+        exceptions(std::ios::badbit);
+      }
+
+      static void
+        release(std::istream* aStream) { delete aStream; }
+  };
+
+/*******************************************************************************
+ * Per SQL text statistics collected by a sqlite3_trace_v2 callback. Nothing
+ * is installed on the connection until tracing is enabled.
+ ******************************************************************************/
+  class TraceStats
+  {
+    public:
+      class Entry
+      {
+        public:
+          sqlite3_int64 theCalls;
+          sqlite3_int64 theTotalNanos;
+          sqlite3_int64 theMaxNanos;
+          sqlite3_int64 theRows;
+
+          Entry() : theCalls(0), theTotalNanos(0), theMaxNanos(0), theRows(0) {}
+      };
+      typedef std::map<std::string, Entry> Entries_t;
+
+    private:
+      sqlite3* theDb;
+      Entries_t theEntries;
+      unsigned int theMask;             // 0 when tracing is disabled
+      sqlite3_int64 theSlowNanos;       // 0 disables the slow query log
+      std::string theSlowLog;
+      std::ofstream theSlowLogStream;   // open while slow queries are logged
+      sqlite3_int64 theSlowQueries;
+
+      static int
+        callback(unsigned int aType, void* aCtx, void* aP, void* aX);
+
+      void
+        logSlowQuery(sqlite3_stmt* aStmt, sqlite3_int64 aNanos);
+
+    public:
+      TraceStats(sqlite3* aDb)
+        : theDb(aDb), theMask(0), theSlowNanos(0), theSlowQueries(0) {}
+
+      void
+        enable(bool aProfile, bool aRows, sqlite3_int64 aSlowMillis,
+               const std::string& aSlowLog);
+      void
+        disable();
+      void
+        reset();
+      bool
+        isEnabled() const { return theMask != 0; }
+      const Entries_t&
+        getEntries() const { return theEntries; }
+      sqlite3_int64
+        getSlowQueries() const { return theSlowQueries; }
+  };
+
+/*******************************************************************************
+ * The columns, indexes and foreign keys of a table as given by the
+ * table_info, index_list, index_info and foreign_key_list pragmas.
+ ******************************************************************************/
+  class TableInfo
+  {
+    public:
+      class Column
+      {
+        public:
+          std::string theName;
+          std::string theType;
+          bool theNotNull;
+          bool theHasDefault;
+          std::string theDefault;       // SQL text of the default value
+          int thePrimaryKey;            // position in the primary key, 0 if not
+      };
+
+      class Index
+      {
+        public:
+          std::string theName;
+          bool theUnique;
+          std::string theOrigin;        // "c", "u" or "pk"
+          bool thePartial;
+          std::vector<std::string> theColumns;
+      };
+
+      class ForeignKey
+      {
+        public:
+          int theId;
+          std::string theTable;
+          std::vector<std::string> theFrom;
+          std::vector<std::string> theTo;
+          std::string theOnUpdate;
+          std::string theOnDelete;
+      };
+
+      std::string theName;
+      std::vector<Column> theColumns;
+      std::vector<Index> theIndexes;
+      std::vector<ForeignKey> theForeignKeys;
+  };
+
+/*******************************************************************************
+ * The TableInfo of a connection's tables, read once for every version of the
+ * schema. Any schema change on the connection or by another one changes the
+ * schema cookie (PRAGMA schema_version) and drops everything.
+ ******************************************************************************/
+  class SchemaCache
+  {
+    private:
+      typedef std::map<std::string, TableInfo*> Tables_t;
+
+      sqlite3* theDb;
+      Tables_t theTables;               // NULL for tables that don't exist
+      int theMainCookie;
+      int theTempCookie;
+      sqlite3_stmt* theMainCookieStmt;  // prepared on first use, kept until
+      sqlite3_stmt* theTempCookieStmt;  // the cache is closed
+
+      // aStmt is prepared with aPragma if it's NULL, and reset after the read
+      int
+        getCookie(sqlite3_stmt*& aStmt, const char* aPragma);
+
+      // The pragma with aTable as its argument
+      sqlite3_stmt*
+        preparePragma(const char* aPragma, const std::string& aTable);
+
+      static std::string
+        getText(sqlite3_stmt* aStmt, int aColumn);
+
+      TableInfo*
+        load(const std::string& aTable);
+
+    public:
+      SchemaCache(sqlite3* aDb)
+        : theDb(aDb), theMainCookie(-1), theTempCookie(-1),
+          theMainCookieStmt(NULL), theTempCookieStmt(NULL) {}
+      ~SchemaCache() { close(); }
+
+      // NULL if there is no such table
+      const TableInfo*
+        getTable(const std::string& aTable);
+      void
+        clear();
+      // Also finalizes the statements, before the database is closed
+      void
+        close();
+  };
+
+/*******************************************************************************
+ * Bounds the time SQLite spends on the statements of a connection. Only the
+ * statement stepped through step() is interrupted by the progress handler,
+ * and only once its own deadline has passed.
+ ******************************************************************************/
+  class QueryTimer
+  {
+    public:
+      enum { CHECK_INTERVAL = 1000 };   // virtual machine instructions
+
+    private:
+      sqlite3* theDb;
+      int theTimeout;                   // default of the connection, 0 if none
+      sqlite3_int64 theDeadline;        // of the statement being stepped
+      bool theInstalled;
+
+      // Not copyable
+      QueryTimer(const QueryTimer&);
+      QueryTimer& operator=(const QueryTimer&);
+
+      static int
+        callback(void* aTimer);
+
+    public:
+      QueryTimer(sqlite3* aDb)
+        : theDb(aDb), theTimeout(0), theDeadline(0), theInstalled(false) {}
+
+      void
+        setTimeout(int aTimeout) { theTimeout = (aTimeout < 0)?0:aTimeout; }
+      int
+        getTimeout() const { return theTimeout; }
+
+      // The deadline of a statement started now, aTimeout < 0 takes the
+      // one of the connection; 0 if there is none
+      sqlite3_int64
+        getDeadline(int aTimeout) const;
+
+      // sqlite3_step(), interrupted once aDeadline (if not 0) has passed
+      int
+        step(sqlite3_stmt* aStmt, sqlite3_int64 aDeadline);
+  };
+
+/*******************************************************************************
+ ******************************************************************************/
+  class Connection
+  {
+    public:
+      enum TX_MODE { TX_NONE, TX_DEFERRED, TX_IMMEDIATE, TX_EXCLUSIVE };
+
+    protected:
+      sqlite3* theDb;
+      TX_MODE theTxMode;
+      StatementCache theStmtCache;
+      ConnectionPool* thePool;  // NULL unless handed out by a pool
+      HandleTable<Blob> theBlobs;
+      TraceStats theTrace;
+      SchemaCache theSchema;
+      ScriptCache theScripts;
+      QueryTimer theTimer;
+      // Name and number of arguments of the functions registered by the query
+      std::vector<std::pair<std::string, int> > theFunctions;
+
+    public:
+      Connection(sqlite3* aDb)
+        : theDb(aDb), theTxMode(TX_NONE), theStmtCache(aDb), thePool(NULL),
+          theBlobs(HANDLE_BLOB), theTrace(aDb), theSchema(aDb), theTimer(aDb) {}
+
+      sqlite3*
+        getDb() const { return theDb; }
+      StatementCache&
+        getStatementCache() { return theStmtCache; }
+      TraceStats&
+        getTrace() { return theTrace; }
+      SchemaCache&
+        getSchema() { return theSchema; }
+      ScriptCache&
+        getScriptCache() { return theScripts; }
+      QueryTimer&
+        getTimer() { return theTimer; }
+      void
+        addFunction(const std::string& aName, int aArity);
+      bool
+        hasFunctions() const { return !theFunctions.empty(); }
+      // Unregisters the functions of the query, false if one of them can't
+      // be removed because a statement is still running
+      bool
+        dropFunctions();
+      unsigned int
+        getLiveStatements() const;
+      void
+        close();
+      ConnectionPool*
+        getPool() const { return thePool; }
+      void
+        setPool(ConnectionPool* aPool) { thePool = aPool; }
+      std::string
+        addBlob(Blob* aBlob);
+      Blob*
+        getBlob(const char* aUUID, size_t aLength);
+      bool
+        closeBlob(const std::string& aUUID);
+      void
+        closeBlobs();
+      void
+        beginTransaction(TX_MODE aMode);
+      void
+        commit();
+      void
+        rollback();
+      TX_MODE
+        getTransactionMode();
+
+      static TX_MODE
+        getModeFromString(const std::string& aMode);
+      static const char*
+        getModeAsString(TX_MODE aMode);
+  };
+
+  class ConnectionPool
+  {
+    public:
+      enum { DEFAULT_MAX_SIZE = 16, DEFAULT_IDLE_TIMEOUT = 60000 };
+
+    private:
+      typedef std::map<std::string, ConnectionPool*> Pools_t;
+      typedef std::list<std::pair<Connection*, sqlite3_int64> > Idle_t;
+
+      static Pools_t thePools;
+      static std::vector<ConnectionPool*> theClosedPools;  // freed at unload
+      static Mutex thePoolsMutex;
+
+      std::string thePath;
+      SqliteOptions* theOptions;
+      Idle_t theIdle;           // most recently returned first
+      std::set<Connection*> theCheckedOut;
+      unsigned int theInUse;
+      sqlite3_int64 theCreated;
+      sqlite3_int64 theReused;
+      bool theClosed;           // connections are closed when checked in
+      Mutex theMutex;
+
+      ConnectionPool(const std::string& aPath, const SqliteOptions& aOptions);
+
+      void
+        close();
+
+      void
+        collectIdle(sqlite3_int64 aNow);
+      static bool
+        isValid(Connection* aConn);
+      static void
+        closeConnection(Connection* aConn);
+
+    public:
+      ~ConnectionPool();
+
+      static ConnectionPool*
+        getPool(const std::string& aName,
+                const std::string& aPath,
+                const SqliteOptions& aOptions);
+      static ConnectionPool*
+        findPool(const std::string& aName);
+      // Removes the pool and closes its idle connections, the ones in use
+      // are closed when their query is done. The pool itself is only freed
+      // when the library is unloaded, queries may still hold it
+      static bool
+        closePool(const std::string& aName);
+      // Interrupts the statements running on the connections checked out of
+      // the pool, whatever query uses them
+      static bool
+        interruptPool(const std::string& aName);
+      // Called when the library is unloaded
+      static void
+        closeAll();
+
+      Connection*
+        checkout();
+      void
+        checkin(Connection* aConn);
+
+      unsigned int
+        getIdle();
+      unsigned int
+        getInUse();
+      unsigned int
+        getMaxSize() const;
+      sqlite3_int64
+        getCreated();
+      sqlite3_int64
+        getReused();
+  };
+
   class ConnMap : public ExternalFunctionParameter
   {
     private:
-      typedef std::map<std::string, sqlite3 *> ConnMap_t;
-      ConnMap_t* connMap;
+      HandleTable<Connection> theConnections;
       StmtMap* sMap;
 
+      void
+        releaseConnection(Connection* aConn);
+
     public:
       ConnMap(StmtMap* sMap);
       virtual ~ConnMap();
-      bool 
-        storeConn(const std::string&, sqlite3 *sql);
+      std::string
+        storeConn(sqlite3 *sql);
+      std::string
+        storeConnection(Connection *aConn);
       sqlite3*
         getConn(const std::string&);
+      Connection*
+        getConnection(const std::string&);
+      Connection*
+        getConnectionForBlob(const std::string&);
+      std::string
+        storeBlob(const std::string& aConnName, Connection* aConn, Blob* aBlob);
+      Blob*
+        getBlob(const std::string&);
+      bool
+        closeBlob(const std::string&);
       bool 
         deleteConn(const std::string&);
       virtual void 
@@ -81,7 +634,10 @@ namespace zorba { namespace sqlite {
 
       typedef std::map<String, ExternalFunction*, ltstr> FuncMap_t;
       FuncMap_t theFunctions;
+      Mutex theFunctionsMutex;  // queries may be compiled in parallel
 
+      static Mutex theKeysMutex;
+      static bool theKeysCreated;
       static zorba::Item globalNameKey;
       static zorba::Item globalDatabaseKey;
       static zorba::Item globalTableKey;
@@ -125,237 +681,1503 @@ namespace zorba { namespace sqlite {
 
 /*******************************************************************************
  ******************************************************************************/
-  class JSONItemSequence : public ItemSequence
+  class QueryOptions {
+  public:
+    enum RESULT_FORMAT { OBJECTS, ARRAYS, COLUMNAR };
+
+    enum { MAX_PREFETCH = 65536 };
+
+  protected:
+    RESULT_FORMAT theResultFormat;
+    unsigned int thePrefetch;           // rows stepped ahead, 0 disables it
+    int theTimeout;                     // milliseconds, -1 for the connection's
+
+  public:
+
+    QueryOptions();
+
+    RESULT_FORMAT
+    getResultFormat() const { return theResultFormat; }
+
+    unsigned int
+    getPrefetch() const { return thePrefetch; }
+
+    int
+    getTimeout() const { return theTimeout; }
+
+    void
+    disablePrefetch() { thePrefetch = 0; }
+
+    void
+    setValues(Item&);
+  };
+
+/*******************************************************************************
+ * Options of s:execute-batch and s:execute-script.
+ ******************************************************************************/
+  class BatchOptions {
+  protected:
+    Connection::TX_MODE theTransaction;   // TX_NONE unless one is wanted
+
+  public:
+
+    BatchOptions() : theTransaction(Connection::TX_NONE) {}
+
+    Connection::TX_MODE
+    getTransaction() const { return theTransaction; }
+
+    void
+    setValues(Item&);
+  };
+
+/*******************************************************************************
+ * Steps a statement on a worker thread and keeps the decoded values of up to
+ * theDepth rows, the query thread only turns them into items. The worker
+ * waits while the buffer is full. The statement must not be used by anybody
+ * else until stop() returns.
+ ******************************************************************************/
+  class RowBuffer
   {
     public:
-      class JSONIterator : public Iterator
+      class Value
       {
-        protected:
-          sqlite3_stmt* theStmt;
-          std::vector<zorba::Item> theColumnNamesZString;
-          int theColumnCount;
-          int theRc;
-          bool isUpdateResult;
-          zorba::ItemFactory* theFactory;
-
         public:
-          JSONIterator(sqlite3_stmt* aPrepStmt):
-              theStmt(aPrepStmt),
-              theRc(0),isUpdateResult(false) {}
+          int theType;
+          sqlite3_int64 theInteger;
+          double theDouble;
+          std::string theBytes;         // TEXT and BLOB values
+      };
 
-          virtual ~JSONIterator() {
-          }
+    private:
+      sqlite3_stmt* theStmt;
+      int theColumnCount;
+      unsigned int theDepth;
+      std::vector<Value> theValues;     // theDepth rows of theColumnCount values
+      unsigned int theHead;
+      unsigned int theCount;
+      bool theFinished;
+      bool theCancelled;
+      int theRc;
+      std::string theError;
+      QueryTimer* theTimer;
+      sqlite3_int64 theDeadline;
+      Mutex theMutex;
+      Condition theNotEmpty;
+      Condition theNotFull;
+      Thread theThread;
 
-          void
-          open();
+      static void
+        run(void* aBuffer);
 
-          bool
-          next(zorba::Item& aItem);
+      void
+        produce();
 
-          void
-          close();
+    public:
+      // Copies the current row of aStmt, the values stay valid after the
+      // statement moves on
+      static void
+        decode(sqlite3_stmt* aStmt, int aColumnCount, Value* aRow);
 
-          bool
-          isOpen() const { return theRc == SQLITE_ROW; }
-      };
+      static zorba::Item
+        createItem(zorba::ItemFactory* aFactory, const Value& aValue);
 
-    protected:
-      sqlite3_stmt* thePrepStmt;
+      // Orders values like SQLite with the BINARY collation: NULL, numbers,
+      // text then blobs
+      static int
+        compare(const Value& aValue1, const Value& aValue2);
 
-    public:
-      JSONItemSequence(sqlite3_stmt* aPrepStmt)
-        : thePrepStmt(aPrepStmt)
-      {}
+      // With aStepped the statement is on its first row already, otherwise
+      // the worker steps it from the start. With aTimer the statement is
+      // interrupted once aDeadline has passed
+      RowBuffer(sqlite3_stmt* aStmt, int aColumnCount, unsigned int aDepth,
+                bool aStepped = true, QueryTimer* aTimer = NULL,
+                sqlite3_int64 aDeadline = 0);
 
-      virtual ~JSONItemSequence() {}
+      ~RowBuffer() { stop(); }
 
-      zorba::Iterator_t 
-        getIterator() { return new JSONIterator(thePrepStmt); }
+      bool
+        start() { return theThread.start(); }
+
+      // Waits for the current row, NULL once the statement is done
+      const Value*
+        front();
+
+      // Frees the current row
+      void
+        pop();
+
+      void
+        stop();
+
+      // SQLITE_DONE or the error code once front() returned NULL
+      int
+        getRc() const { return theRc; }
+      const std::string&
+        getError() const { return theError; }
   };
 
 /*******************************************************************************
+ * A function item registered with s:register-function. SQL calls it through
+ * a query compiled once for each number of arguments, with the function and
+ * the arguments bound as external variables. Aggregates call theFunction
+ * with the accumulator and the values of each row, then theFinal (if any)
+ * with the accumulator once the group is done.
+ *
+ * Results of deterministic scalar functions are kept for up to theMemoSize
+ * distinct arguments. SQLite owns the object, it is deleted once the
+ * function is replaced, removed or the connection closed.
  ******************************************************************************/
-#ifdef ZORBA_SQLITE_HAVE_METADATA
-  class JSONMetadataItemSequence : public ItemSequence
+  class UserFunction
   {
     public:
-      class JSONMetadataIterator : public Iterator
-      {
-        protected:
-          sqlite3_stmt* theStmt;
-          int theColumnCount;
-          int theRc;
-          int theActualColumn;
-          zorba::ItemFactory* theFactory;
+      enum { DEFAULT_MEMO_SIZE = 1024 };
 
-        public:
-          JSONMetadataIterator(sqlite3_stmt* aPrepStmt):
-              theStmt(aPrepStmt),theColumnCount(0),
-              theRc(0), theActualColumn(0) {}
+      typedef std::vector<zorba::Item> Sequence_t;
 
-          virtual ~JSONMetadataIterator() {
-          }
+    private:
+      typedef std::map<std::string, RowBuffer::Value> Memo_t;
+      typedef std::map<int, XQuery_t> Callers_t;
+
+      zorba::Item theFunction;
+      zorba::Item theFinal;             // aggregates only, null if none
+      Sequence_t theInitial;            // aggregates only
+      bool theAggregate;
+      unsigned int theMemoSize;         // 0 disables the memo
+      Memo_t theMemo;
+      Callers_t theCallers;             // by number of arguments
+      int theDepth;                     // calls running
+      ThreadId theThread;               // the query thread
+
+      // Not copyable
+      UserFunction(const UserFunction&);
+      UserFunction& operator=(const UserFunction&);
+
+      // Items only live on the query thread, a statement stepped by a worker
+      // gets an error instead
+      bool
+        isCallable(sqlite3_context* aCtx) const;
+
+      void
+        call(const zorba::Item& aFunction,
+             const std::vector<Sequence_t>& aArgs,
+             Sequence_t& aResult);
 
-          void
-          open();
+      static std::string
+        getCaller(int aArgc);
+
+      static void
+        decode(sqlite3_value* aValue, RowBuffer::Value& aResult);
+
+      static void
+        encode(const Sequence_t& aValue, RowBuffer::Value& aResult);
+
+      static void
+        setResult(sqlite3_context* aCtx, const RowBuffer::Value& aValue);
+
+    public:
+      UserFunction(const zorba::Item& aFunction, unsigned int aMemoSize);
+
+      UserFunction(const zorba::Item& aStep, const zorba::Item& aFinal,
+                   const Sequence_t& aInitial);
+
+      ~UserFunction();
+
+      bool
+        isAggregate() const { return theAggregate; }
+
+      static void
+        callScalar(sqlite3_context* aCtx, int aArgc, sqlite3_value** aArgv);
+      static void
+        callStep(sqlite3_context* aCtx, int aArgc, sqlite3_value** aArgv);
+      static void
+        callFinal(sqlite3_context* aCtx);
+      static void
+        destroy(void* aFunction);
+  };
+
+/*******************************************************************************
+ * A query run by s:execute-async. The statement is prepared and bound on the
+ * query thread, a worker of the AsyncExecutor steps it and keeps the decoded
+ * rows until s:await turns them into items.
+ ******************************************************************************/
+  class AsyncJob
+  {
+    public:
+      enum State { QUEUED, RUNNING, DONE };
+      typedef std::deque<std::vector<RowBuffer::Value> > Rows_t;
+
+      sqlite3_stmt* theStmt;
+      sqlite3* theDb;
+      std::string theFile;      // empty when running on the caller's connection
+      State theState;
+      bool theAbandoned;        // nobody waits for it anymore
+      std::vector<std::string> theColumns;
+      Rows_t theRows;
+      int theRc;
+      std::string theError;
+      // SQLite forgets an interrupt that comes before the first step, the
+      // flag is checked again between the rows
+      bool theInterrupted;
+      Mutex theInterruptMutex;
+
+      AsyncJob(sqlite3_stmt* aStmt, const std::string& aFile)
+        : theStmt(aStmt), theDb(sqlite3_db_handle(aStmt)), theFile(aFile),
+          theState(QUEUED), theAbandoned(false), theRc(SQLITE_OK),
+          theInterrupted(false) {}
+
+      // Steps the statement to the end, on whatever thread calls it
+      void
+        execute();
+      // Makes execute() stop before the next row, ends with SQLITE_INTERRUPT
+      void
+        interrupt();
+      bool
+        isInterrupted();
+  };
+
+/*******************************************************************************
+ * Worker threads shared by every query using the module. Jobs on database
+ * files get a read-only connection of their own, the idle ones are kept per
+ * file for the next jobs.
+ ******************************************************************************/
+  class AsyncExecutor
+  {
+    public:
+      enum { DEFAULT_THREADS = 4 };
+
+    private:
+      typedef std::multimap<std::string, sqlite3*> Idle_t;
+      typedef std::map<sqlite3*, unsigned int> Busy_t;
+
+      static AsyncExecutor* theInstance;
+      static Mutex theInstanceMutex;
+
+      Mutex theMutex;
+      Condition theWork;
+      Condition theDone;
+      std::list<AsyncJob*> theQueue;
+      std::vector<Thread*> theThreads;
+      Idle_t theIdle;
+      Busy_t theBusy;           // unfinished jobs on a caller's connection
+      bool theStopping;
+
+      AsyncExecutor() : theStopping(false) {}
+      ~AsyncExecutor();
+
+      static void
+        run(void* aExecutor);
+
+      void
+        work();
+
+      // The caller holds theMutex
+      void
+        freeJob(AsyncJob* aJob);
+      // The caller holds theMutex
+      void
+        finishJob(AsyncJob* aJob);
+
+    public:
+      static AsyncExecutor*
+        getInstance();
+      static void
+        shutdown();
+      // Releases the jobs of a query, they are freed directly if the
+      // executor is shut down already
+      static void
+        releaseJobs(const std::vector<AsyncJob*>& aJobs);
+      // True while a job queued or running on aDb isn't done, such a
+      // connection can't be handed to another query
+      static bool
+        hasJobs(sqlite3* aDb);
+
+      // A read-only connection to aFile, NULL if it can't be opened
+      sqlite3*
+        takeConnection(const std::string& aFile);
+      void
+        returnConnection(const std::string& aFile, sqlite3* aDb);
+
+      void
+        submit(AsyncJob* aJob);
+
+      void
+        wait(AsyncJob* aJob);
+
+      // Waits until one of aJobs is done and returns its position
+      size_t
+        waitAny(const std::vector<AsyncJob*>& aJobs);
+
+      // Drops a job. A running job on a file is interrupted and freed by its
+      // worker, one on the caller's connection is interrupted and waited for
+      // so the connection is idle when the query releases it
+      void
+        release(AsyncJob* aJob);
+
+      // Interrupts the job if it is running, it ends with SQLITE_INTERRUPT
+      void
+        interrupt(AsyncJob* aJob);
+  };
+
+/*******************************************************************************
+ * The async jobs started by a query, the ones not awaited are released with
+ * the dynamic context.
+ ******************************************************************************/
+  class AsyncMap : public ExternalFunctionParameter
+  {
+    private:
+      HandleTable<AsyncJob> theJobs;
+
+    public:
+      AsyncMap() : theJobs(HANDLE_ASYNC) {}
+      virtual ~AsyncMap() {}
+
+      std::string
+        storeJob(AsyncJob* aJob) { return theJobs.add(aJob); }
+      AsyncJob*
+        getJob(const std::string& aHandle) { return theJobs.get(aHandle); }
+      AsyncJob*
+        removeJob(const std::string& aHandle) { return theJobs.remove(aHandle); }
+      virtual void
+        destroy() throw();
+  };
+
+/*******************************************************************************
+ ******************************************************************************/
+  class JSONItemSequence : public ItemSequence
+  {
+    public:
+      class JSONIterator : public Iterator
+      {
+        protected:
+          sqlite3_stmt* theStmt;
+          StatementCache* theCache;
+          std::string theSql;
+          QueryOptions theOptions;
+          std::vector<zorba::Item> theColumnNamesZString;
+          int theColumnCount;
+          int theRc;
+          bool isUpdateResult;
+          bool theHeaderReturned;
+          zorba::ItemFactory* theFactory;
+          RowBuffer* thePrefetch;
+          const RowBuffer::Value* theRow;
+          QueryTimer* theTimer;
+          sqlite3_int64 theDeadline;
+
+          void
+          releaseStatement();
+
+          int
+          step();
+
+          // Gives the statement back and raises the error of theRc
+          void
+          fail(const std::string& aError);
+
+          void
+          stopPrefetch();
+
+          void
+          stepRow();
+
+          zorba::Item
+          getColumnValue(int aColumn);
+
+        public:
+          JSONIterator(sqlite3_stmt* aPrepStmt,
+                       StatementCache* aCache = NULL,
+                       const std::string& aSql = std::string(),
+                       const QueryOptions& aOptions = QueryOptions(),
+                       QueryTimer* aTimer = NULL):
+              theStmt(aPrepStmt), theCache(aCache), theSql(aSql),
+              theOptions(aOptions), theColumnCount(0), theRc(0),
+              isUpdateResult(false), theHeaderReturned(false),
+              thePrefetch(NULL), theRow(NULL), theTimer(aTimer),
+              theDeadline(0) {}
+
+          virtual ~JSONIterator() {
+            stopPrefetch();
+            // A result dropped halfway would keep its read transaction open
+            if(theStmt != NULL && theRc == SQLITE_ROW)
+              sqlite3_reset(theStmt);
+            releaseStatement();
+          }
+
+          void
+          open();
+
+          bool
+          next(zorba::Item& aItem);
+
+          void
+          close();
+
+          bool
+          isOpen() const { return theRc == SQLITE_ROW; }
+      };
+
+    protected:
+      sqlite3_stmt* thePrepStmt;
+      // Set when the statement was taken from a connection's statement
+      // cache; the iterator hands it back once the result is consumed
+      StatementCache* theCache;
+      std::string theSql;
+      QueryOptions theOptions;
+      QueryTimer* theTimer;
+
+    public:
+      JSONItemSequence(sqlite3_stmt* aPrepStmt,
+                       StatementCache* aCache = NULL,
+                       const std::string& aSql = std::string())
+        : thePrepStmt(aPrepStmt), theCache(aCache), theSql(aSql), theTimer(NULL)
+      {}
+
+      virtual ~JSONItemSequence();
+
+      void
+        setOptions(const QueryOptions& aOptions) { theOptions = aOptions; }
+
+      // The statement is bounded by the timeout of the timer's connection
+      void
+        setTimer(QueryTimer* aTimer) { theTimer = aTimer; }
+
+      zorba::Iterator_t 
+        getIterator();
+  };
+
+/*******************************************************************************
+ * Options of s:execute-sharded.
+ ******************************************************************************/
+  class ShardOptions {
+  public:
+    enum AGGREGATE { NONE, SUM, COUNT, MIN, MAX };
+    enum { DEFAULT_PREFETCH = 256 };
+
+  protected:
+    std::string theOrderBy;
+    bool theDescending;
+    std::map<std::string, AGGREGATE> theAggregates;
+    unsigned int thePrefetch;
+    zorba::Item theParams;
+
+  public:
+
+    ShardOptions();
+
+    const std::string&
+    getOrderBy() const { return theOrderBy; }
+
+    bool
+    getDescending() const { return theDescending; }
+
+    // NONE for the columns that are grouped on
+    AGGREGATE
+    getAggregate(const std::string& aColumn) const;
+
+    bool
+    hasAggregates() const { return !theAggregates.empty(); }
+
+    unsigned int
+    getPrefetch() const { return thePrefetch; }
+
+    const zorba::Item&
+    getParams() const { return theParams; }
+
+    void
+    setValues(Item&);
+  };
+
+/*******************************************************************************
+ * The rows of the same query run on several database files. Every shard
+ * is stepped by a RowBuffer of its own, the iterator returns the rows shard
+ * after shard, merged on a column or aggregated.
+ ******************************************************************************/
+  class ShardedItemSequence : public ItemSequence
+  {
+    public:
+      class Shard
+      {
+        public:
+          sqlite3* theDb;
+          sqlite3_stmt* theStmt;
+      };
+
+      class ShardedIterator : public Iterator
+      {
+        protected:
+          ShardedItemSequence* theSequence;
+          std::vector<RowBuffer*> theBuffers;
+          std::vector<const RowBuffer::Value*> theRows;
+          std::vector<zorba::Item> theKeys;
+          size_t theCurrent;              // shard read without a merge
+          std::vector<zorba::Item> theAggregated;
+          size_t theNextAggregated;
+          bool theOpen;
+          zorba::ItemFactory* theFactory;
+
+          void
+          stopBuffers();
+
+          // Frees the current row of a shard and waits for its next one
+          void
+          advance(size_t aShard);
+
+          zorba::Item
+          createRow(const RowBuffer::Value* aRow);
+
+          void
+          aggregate();
+
+          static void
+          combine(ShardOptions::AGGREGATE aAggregate,
+                  RowBuffer::Value& aResult,
+                  const RowBuffer::Value& aValue);
+
+        public:
+          ShardedIterator(ShardedItemSequence* aSequence)
+            : theSequence(aSequence), theCurrent(0), theNextAggregated(0),
+              theOpen(false), theFactory(NULL) {}
+
+          virtual ~ShardedIterator() { stopBuffers(); }
+
+          void
+          open();
+
+          bool
+          next(zorba::Item& aItem);
+
+          void
+          close();
+
+          bool
+          isOpen() const { return theOpen; }
+      };
+
+    protected:
+      std::vector<Shard> theShards;
+      std::vector<std::string> theColumns;
+      int theOrderColumn;               // -1 without "order-by"
+      ShardOptions theOptions;
+
+    public:
+      ShardedItemSequence(const ShardOptions& aOptions)
+        : theOrderColumn(-1), theOptions(aOptions) {}
+
+      virtual ~ShardedItemSequence();
+
+      // Takes over the connection and the statement
+      void
+        addShard(sqlite3* aDb, sqlite3_stmt* aStmt);
+
+      // Checks that the shards return the same columns and resolves the
+      // columns named in the options
+      void
+        init();
+
+      zorba::Iterator_t 
+        getIterator() { return new ShardedIterator(this); }
+  };
+
+/*******************************************************************************
+ * Options of s:backup.
+ ******************************************************************************/
+  class BackupOptions {
+  public:
+    enum { DEFAULT_PAGES_PER_STEP = 100, BUSY_RETRIES = 100, BUSY_SLEEP = 10 };
+
+  protected:
+    std::string theDatabase;
+    int thePagesPerStep;                // -1 copies everything in one step
+    int theSleep;                       // milliseconds between the steps
+    bool theProgress;
+
+  public:
+
+    BackupOptions();
+
+    const std::string&
+    getDatabase() const { return theDatabase; }
+
+    int
+    getPagesPerStep() const { return thePagesPerStep; }
+
+    int
+    getSleep() const { return theSleep; }
+
+    bool
+    getProgress() const { return theProgress; }
+
+    void
+    setValues(Item&);
+  };
+
+/*******************************************************************************
+ * Options of s:register-function.
+ ******************************************************************************/
+  class FunctionOptions {
+  public:
+    enum { MAX_ARITY = 127 };           // SQLITE_MAX_FUNCTION_ARG by default
+
+  protected:
+    int theArity;                       // -1 takes any number of arguments
+    bool theDeterministic;
+    unsigned int theMemoSize;
+    zorba::Item theInitial;             // null if not given
+
+  public:
+
+    FunctionOptions();
+
+    int
+    getArity() const { return theArity; }
+
+    bool
+    getDeterministic() const { return theDeterministic; }
+
+    // Results are only kept for deterministic functions
+    unsigned int
+    getMemoSize() const { return theDeterministic?theMemoSize:0; }
+
+    const zorba::Item&
+    getInitial() const { return theInitial; }
+
+    void
+    setValues(Item&);
+  };
+
+/*******************************************************************************
+ ******************************************************************************/
+#ifdef ZORBA_SQLITE_HAVE_METADATA
+  class JSONMetadataItemSequence : public ItemSequence
+  {
+    public:
+      class JSONMetadataIterator : public Iterator
+      {
+        protected:
+          sqlite3_stmt* theStmt;
+          int theColumnCount;
+          int theRc;
+          int theActualColumn;
+          zorba::ItemFactory* theFactory;
+
+        public:
+          JSONMetadataIterator(sqlite3_stmt* aPrepStmt):
+              theStmt(aPrepStmt),theColumnCount(0),
+              theRc(0), theActualColumn(0) {}
+
+          virtual ~JSONMetadataIterator() {
+          }
+
+          void
+          open();
+
+          bool
+          next(zorba::Item& aItem);
+
+          void
+          close();
+
+          bool
+          isOpen() const { return theRc == SQLITE_ROW; }
+      };
+
+    protected:
+      sqlite3_stmt* thePrepStmt;
+
+    public:
+      JSONMetadataItemSequence(sqlite3_stmt* aPrepStmt)
+        : thePrepStmt(aPrepStmt)
+      {}
+
+      virtual ~JSONMetadataItemSequence() {}
+
+      zorba::Iterator_t 
+        getIterator() { return new JSONMetadataIterator(thePrepStmt); }
+  };
+#endif
+
+/*******************************************************************************
+ ******************************************************************************/
+  class SqliteOptions {
+  protected:
+    bool theOpenReadOnly;
+    bool theOpenCreate;
+    bool theOpenNoMutex;
+    bool theOpenSharedCache;
+    unsigned int theStatementCacheSize;
+    // Performance pragmas, empty when the option wasn't given
+    std::string theJournalMode;
+    std::string theSynchronous;
+    std::string theCacheSize;
+    std::string theMmapSize;
+    std::string theTempStore;
+    std::string thePageSize;
+    std::string theLockingMode;
+    int theBusyTimeout;
+    int theTimeout;
+    unsigned int thePoolMaxSize;
+    int thePoolIdleTimeout;
+
+  public:
+
+    SqliteOptions();
+
+    bool
+    getOpenReadOnly() { return theOpenReadOnly; }
+
+    void
+    setOpenReadOnly(bool aReadOnly) { theOpenReadOnly = aReadOnly; }
+
+    bool
+    getOpenCreate() { return theOpenCreate; }
+
+    void
+    setOpenCreate(bool aCreate) { theOpenCreate = aCreate; }
+
+    bool
+    getOpenNoMutex() { return theOpenNoMutex; }
+
+    bool
+    getOpenSharedCache() { return theOpenSharedCache; }
+
+    unsigned int
+    getStatementCacheSize() { return theStatementCacheSize; }
+
+    const std::string&
+    getJournalMode() { return theJournalMode; }
+
+    const std::string&
+    getSynchronous() { return theSynchronous; }
+
+    const std::string&
+    getCacheSize() { return theCacheSize; }
+
+    const std::string&
+    getMmapSize() { return theMmapSize; }
+
+    const std::string&
+    getTempStore() { return theTempStore; }
+
+    const std::string&
+    getPageSize() { return thePageSize; }
+
+    const std::string&
+    getLockingMode() { return theLockingMode; }
+
+    int
+    getBusyTimeout() { return theBusyTimeout; }
+
+    int
+    getTimeout() { return theTimeout; }
+
+    unsigned int
+    getPoolMaxSize() const { return thePoolMaxSize; }
+
+    int
+    getPoolIdleTimeout() const { return thePoolIdleTimeout; }
+
+    void
+    setValues(Item&);
+
+    void
+    setValues(struct sqlite3* aSqlite);
+
+    void
+    applyPragmas(struct sqlite3* aSqlite);
+
+    int
+    getOptionsAsInt();
+    
+    std::string
+    getOptionsAsString();
+
+  protected:
+    static std::string
+      getAttributeValue(
+      const Item& aNode,
+      const String& aAttrName = "value");
+
+    static std::string
+      getEnumValue(
+      const Item& aKey,
+      const Item& aValue,
+      const char* const* aAllowed);
+
+    static std::string
+      getIntegerValue(
+      const Item& aKey,
+      const Item& aValue,
+      bool aAllowNegative);
+
+    static std::string
+      getPragma(struct sqlite3* aSqlite, const char* aPragma);
+  };
+
+/*******************************************************************************
+ ******************************************************************************/
+  class SqliteFunction : public ContextualExternalFunction {
+    protected:
+      const SqliteModule* theModule;
+
+    public:
+      SqliteFunction(const SqliteModule* module);
+      virtual ~SqliteFunction();
+
+      static zorba::Item
+      getOneItem(const Arguments_t& aArgs, int aIndex);
+
+      // The timer of the connection aStmt was prepared on, NULL if it is not
+      // a connection of the query
+      static QueryTimer*
+      getTimer(const zorba::DynamicContext* aDctx, const std::string& aStmtUUID);
+
+      // Rows aren't read ahead on a connection with functions registered,
+      // those can only be called on the query thread
+      static QueryOptions
+      getQueryOptions(const Arguments_t& aArgs, int aIndex,
+        const Connection* aConn = NULL);
+
+      static Blob*
+      getBlob(const zorba::DynamicContext* aDctx, const std::string& aUUID);
+
+      static void
+      checkBlobRange(Blob* aBlob, sqlite3_int64 aOffset, sqlite3_int64 aLength);
+
+      static ConnMap*
+      getConnectionMap(const zorba::DynamicContext* aDctx);
+
+      static StmtMap*
+      getStatementMap(const zorba::DynamicContext* aDctx);
+
+      static AsyncMap*
+      getAsyncMap(const zorba::DynamicContext* aDctx);
+
+      // Waits for the job behind aHandle, removes it from the query and
+      // returns its rows as objects
+      static void
+      awaitJob(const zorba::DynamicContext* aDctx,
+        const std::string& aHandle,
+        std::vector<zorba::Item>& aRows);
+
+
+      static Connection*
+      getConnection(const zorba::DynamicContext* aDctx,
+        const std::string& aUUID);
+
+      static void
+      executeSql(sqlite3* aDb, const char* aSql);
+
+      // Raises the error of a statement that failed with aRc, an interrupted
+      // statement timed out if aDeadline (when not 0) has passed
+      static void
+      throwStepError(int aRc, const std::string& aError, sqlite3_int64 aDeadline);
+
+      static sqlite3*
+      openDatabase(std::string aDbName, SqliteOptions& aOptions);
+
+      static sqlite3_stmt*
+      prepareStatement(sqlite3* aDb, const std::string& aQry);
+
+      // Prepares the first statement of aSql, aTail is set to what follows
+      // it; NULL if there is only whitespace or comments
+      static sqlite3_stmt*
+      prepareStatement(sqlite3* aDb, const char* aSql, int aLength,
+        const char** aTail);
+
+      static sqlite3_stmt* 
+      createPreparedStatement(const zorba::DynamicContext* aDctx,
+        std::string aUUID,
+        std::string aQry);
+
+      static void
+      setValueToStatement(const zorba::DynamicContext* aDctx,
+        std::string aUUID,
+        int aPos,
+        bool aVal);
+
+      static void
+      setValueToStatement(const zorba::DynamicContext* aDctx,
+        std::string aUUID,
+        int aPos,
+        int aVal);
+
+      static void
+      setValueToStatement(const zorba::DynamicContext* aDctx, 
+        std::string aUUID,
+        int aPos,
+        double aVal);
+
+      static void
+      setValueToStatement(const zorba::DynamicContext* aDctx,
+        std::string aUUID,
+        int aPos,
+        std::string aVal);
+
+      static void
+      setValueToStatement(const zorba::DynamicContext* aDctx,
+        std::string aUUID,
+        int aPos);
+
+      static void
+      clearValues(const zorba::DynamicContext* aDctx,
+        std::string aUUID);
+
+      // The SQLite value of an atomic item
+      static void
+      getItemValue(const zorba::Item& aItem, RowBuffer::Value& aValue);
+
+      static void
+      bindItem(sqlite3_stmt* aStmt, int aPos, const zorba::Item& aItem);
+
+      static void
+      bindParameters(sqlite3_stmt* aStmt, const zorba::Item& aParams, StmtMap* aMap);
+
+      static int
+      getParameterIndex(sqlite3_stmt* aStmt, const std::string& aName);
+
+      virtual String
+      getURI() const;
+
+      static void
+      throwError(const char*, const char*);
+
+      static void
+      checkForError(int aErrNo, const char* aLocalName, sqlite3 *sql);
+
+      static int
+      strToInt(std::string str);
+
+      static sqlite3_int64
+      strToLong(std::string str);
+
+      static double
+      strToDouble(std::string strcat);
+
+      static const char *
+      getErrorMessage(std::string error);
+
+  };
+
+  class ConnectFunction : public SqliteFunction {
+  public:
+    ConnectFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ConnectFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "connect"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class IsConnectedFunction : public SqliteFunction {
+  public:
+    IsConnectedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~IsConnectedFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "is-connected"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class CommitFunction : public SqliteFunction {
+  public:
+    CommitFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~CommitFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "commit"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class BeginTransactionFunction : public SqliteFunction {
+  public:
+    BeginTransactionFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~BeginTransactionFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "begin-transaction"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class TransactionStateFunction : public SqliteFunction {
+  public:
+    TransactionStateFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~TransactionStateFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "transaction-state"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class RollbackFunction : public SqliteFunction {
+  public:
+    RollbackFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~RollbackFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "rollback"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ExecuteQueryFunction : public SqliteFunction {
+  public:
+    ExecuteQueryFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ExecuteQueryFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "execute-query"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ExecuteUpdateFunction : public SqliteFunction {
+  public:
+    ExecuteUpdateFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ExecuteUpdateFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "execute-update"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class MetadataFunction : public SqliteFunction {
+  public:
+    MetadataFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~MetadataFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "metadata"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class PrepareStatementFunction : public SqliteFunction {
+  public:
+    PrepareStatementFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~PrepareStatementFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "prepare-statement"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class SetValueFunction : public SqliteFunction {
+  public:
+    SetValueFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~SetValueFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "set-value"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class SetBooleanFunction : public SqliteFunction {
+  public:
+    SetBooleanFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~SetBooleanFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "set-boolean"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class SetNumericFunction : public SqliteFunction {
+  public:
+    SetNumericFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~SetNumericFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "set-numeric"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class SetStringFunction : public SqliteFunction {
+  public:
+    SetStringFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~SetStringFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "set-string"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class SetNullFunction : public SqliteFunction {
+  public:
+    SetNullFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~SetNullFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "set-null"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ClearParamsFunction : public SqliteFunction {
+  public:
+    ClearParamsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ClearParamsFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "clear-params"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+  
+  class ClosePreparedFunction : public SqliteFunction {
+  public:
+    ClosePreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ClosePreparedFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "close-prepared"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ExecuteQueryPreparedFunction : public SqliteFunction {
+  public:
+    ExecuteQueryPreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ExecuteQueryPreparedFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "execute-query-prepared"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ExecuteUpdatePreparedFunction : public SqliteFunction {
+  public:
+    ExecuteUpdatePreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ExecuteUpdatePreparedFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "execute-update-prepared"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ExecuteBatchFunction : public SqliteFunction {
+  public:
+    ExecuteBatchFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~ExecuteBatchFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "execute-batch"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class StatementCacheStatsFunction : public SqliteFunction {
+  public:
+    StatementCacheStatsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~StatementCacheStatsFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "statement-cache-stats"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class LiveStatementsFunction : public SqliteFunction {
+  public:
+    LiveStatementsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~LiveStatementsFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "live-statements"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
+
+  class ConnectionSettingsFunction : public SqliteFunction {
+  public:
+    ConnectionSettingsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-          bool
-          next(zorba::Item& aItem);
+    virtual ~ConnectionSettingsFunction() {}
 
-          void
-          close();
+    virtual zorba::String
+      getLocalName() const { return "connection-settings"; }
 
-          bool
-          isOpen() const { return theRc == SQLITE_ROW; }
-      };
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-    protected:
-      sqlite3_stmt* thePrepStmt;
+  class ConnectPooledFunction : public SqliteFunction {
+  public:
+    ConnectPooledFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    public:
-      JSONMetadataItemSequence(sqlite3_stmt* aPrepStmt)
-        : thePrepStmt(aPrepStmt)
-      {}
+    virtual ~ConnectPooledFunction() {}
 
-      virtual ~JSONMetadataItemSequence() {}
+    virtual zorba::String
+      getLocalName() const { return "connect-pooled"; }
 
-      zorba::Iterator_t 
-        getIterator() { return new JSONMetadataIterator(thePrepStmt); }
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
   };
-#endif
-
-/*******************************************************************************
- ******************************************************************************/
-  class SqliteOptions {
-  protected:
-    bool theOpenReadOnly;
-    bool theOpenCreate;
-    bool theOpenNoMutex;
-    bool theOpenSharedCache;
 
+  class PoolStatsFunction : public SqliteFunction {
   public:
+    PoolStatsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    SqliteOptions();
-
-    bool
-    getOpenReadOnly() { return theOpenReadOnly; }
+    virtual ~PoolStatsFunction() {}
 
-    bool
-    getOpenCreate() { return theOpenCreate; }
+    virtual zorba::String
+      getLocalName() const { return "pool-stats"; }
 
-    bool
-    getOpenNoMutex() { return theOpenNoMutex; }
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-    bool
-    getOpenSharedCache() { return theOpenSharedCache; }
+  class BlobOpenFunction : public SqliteFunction {
+  public:
+    BlobOpenFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    void
-    setValues(Item&);
+    virtual ~BlobOpenFunction() {}
 
-    void
-    setValues(struct sqlite3* aSqlite);
+    virtual zorba::String
+      getLocalName() const { return "blob-open"; }
 
-    int
-    getOptionsAsInt();
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
     
-    std::string
-    getOptionsAsString();
+  };
 
-  protected:
-    static std::string
-      getAttributeValue(
-      const Item& aNode,
-      const String& aAttrName = "value");
+  class BlobSizeFunction : public SqliteFunction {
+  public:
+    BlobSizeFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+
+    virtual ~BlobSizeFunction() {}
+
+    virtual zorba::String
+      getLocalName() const { return "blob-size"; }
+
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
   };
 
-/*******************************************************************************
- ******************************************************************************/
-  class SqliteFunction : public ContextualExternalFunction {
-    protected:
-      const SqliteModule* theModule;
+  class BlobReadFunction : public SqliteFunction {
+  public:
+    BlobReadFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    public:
-      SqliteFunction(const SqliteModule* module);
-      virtual ~SqliteFunction();
+    virtual ~BlobReadFunction() {}
 
-      static zorba::Item
-      getOneItem(const Arguments_t& aArgs, int aIndex);
+    virtual zorba::String
+      getLocalName() const { return "blob-read"; }
 
-      static ConnMap*
-      getConnectionMap(const zorba::DynamicContext* aDctx);
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-      static StmtMap*
-      getStatementMap(const zorba::DynamicContext* aDctx);
+  class BlobWriteFunction : public SqliteFunction {
+  public:
+    BlobWriteFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-      static std::string
-      createUUID();
+    virtual ~BlobWriteFunction() {}
 
-      static sqlite3_stmt* 
-      createPreparedStatement(const zorba::DynamicContext* aDctx,
-        std::string aUUID,
-        std::string aQry);
+    virtual zorba::String
+      getLocalName() const { return "blob-write"; }
 
-      static void
-      setValueToStatement(const zorba::DynamicContext* aDctx,
-        std::string aUUID,
-        int aPos,
-        bool aVal);
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-      static void
-      setValueToStatement(const zorba::DynamicContext* aDctx,
-        std::string aUUID,
-        int aPos,
-        int aVal);
+  class BlobCloseFunction : public SqliteFunction {
+  public:
+    BlobCloseFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-      static void
-      setValueToStatement(const zorba::DynamicContext* aDctx, 
-        std::string aUUID,
-        int aPos,
-        double aVal);
+    virtual ~BlobCloseFunction() {}
 
-      static void
-      setValueToStatement(const zorba::DynamicContext* aDctx,
-        std::string aUUID,
-        int aPos,
-        std::string aVal);
+    virtual zorba::String
+      getLocalName() const { return "blob-close"; }
 
-      static void
-      setValueToStatement(const zorba::DynamicContext* aDctx,
-        std::string aUUID,
-        int aPos);
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-      static void
-      clearValues(const zorba::DynamicContext* aDctx,
-        std::string aUUID);
+  class BindFunction : public SqliteFunction {
+  public:
+    BindFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-      virtual String
-      getURI() const;
+    virtual ~BindFunction() {}
 
-      static void
-      throwError(const char*, const char*);
+    virtual zorba::String
+      getLocalName() const { return "bind"; }
 
-      static void
-      checkForError(int aErrNo, const char* aLocalName, sqlite3 *sql);
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
+  };
 
-      static int
-      strToInt(std::string str);
+  class SetTraceFunction : public SqliteFunction {
+  public:
+    SetTraceFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-      static double
-      strToDouble(std::string strcat);
+    virtual ~SetTraceFunction() {}
 
-      static const char *
-      getErrorMessage(std::string error);
+    virtual zorba::String
+      getLocalName() const { return "set-trace"; }
 
+    virtual zorba::ItemSequence_t
+      evaluate(const Arguments_t&,
+               const zorba::StaticContext*,
+               const zorba::DynamicContext*) const;
+    
   };
 
-  class ConnectFunction : public SqliteFunction {
+  class TraceStatsFunction : public SqliteFunction {
   public:
-    ConnectFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    TraceStatsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ConnectFunction() {}
+    virtual ~TraceStatsFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "connect"; }
+      getLocalName() const { return "trace-stats"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -364,14 +2186,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class IsConnectedFunction : public SqliteFunction {
+  class StatementStatsFunction : public SqliteFunction {
   public:
-    IsConnectedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    StatementStatsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~IsConnectedFunction() {}
+    virtual ~StatementStatsFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "is-connected"; }
+      getLocalName() const { return "statement-stats"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -380,14 +2202,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class CommitFunction : public SqliteFunction {
+  class ConnectionStatsFunction : public SqliteFunction {
   public:
-    CommitFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ConnectionStatsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~CommitFunction() {}
+    virtual ~ConnectionStatsFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "commit"; }
+      getLocalName() const { return "connection-stats"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -396,14 +2218,18 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class RollbackFunction : public SqliteFunction {
+  class ExplainFunction : public SqliteFunction {
+  protected:
+    static bool
+      isFullScan(const std::string& aDetail);
+
   public:
-    RollbackFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ExplainFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~RollbackFunction() {}
+    virtual ~ExplainFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "rollback"; }
+      getLocalName() const { return "explain"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -412,14 +2238,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class ExecuteQueryFunction : public SqliteFunction {
+  class ExecuteAsyncFunction : public SqliteFunction {
   public:
-    ExecuteQueryFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ExecuteAsyncFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ExecuteQueryFunction() {}
+    virtual ~ExecuteAsyncFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "execute-query"; }
+      getLocalName() const { return "execute-async"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -428,14 +2254,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class ExecuteUpdateFunction : public SqliteFunction {
+  class AwaitFunction : public SqliteFunction {
   public:
-    ExecuteUpdateFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    AwaitFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ExecuteUpdateFunction() {}
+    virtual ~AwaitFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "execute-update"; }
+      getLocalName() const { return "await"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -444,14 +2270,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class MetadataFunction : public SqliteFunction {
+  class AwaitAnyFunction : public SqliteFunction {
   public:
-    MetadataFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    AwaitAnyFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~MetadataFunction() {}
+    virtual ~AwaitAnyFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "metadata"; }
+      getLocalName() const { return "await-any"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -460,14 +2286,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class PrepareStatementFunction : public SqliteFunction {
+  class ExecuteShardedFunction : public SqliteFunction {
   public:
-    PrepareStatementFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ExecuteShardedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~PrepareStatementFunction() {}
+    virtual ~ExecuteShardedFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "prepare-statement"; }
+      getLocalName() const { return "execute-sharded"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -476,14 +2302,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class SetValueFunction : public SqliteFunction {
+  class TableInfoFunction : public SqliteFunction {
   public:
-    SetValueFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    TableInfoFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~SetValueFunction() {}
+    virtual ~TableInfoFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "set-value"; }
+      getLocalName() const { return "table-info"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -492,14 +2318,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class SetBooleanFunction : public SqliteFunction {
+  class ExecuteScriptFunction : public SqliteFunction {
   public:
-    SetBooleanFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ExecuteScriptFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~SetBooleanFunction() {}
+    virtual ~ExecuteScriptFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "set-boolean"; }
+      getLocalName() const { return "execute-script"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -508,14 +2334,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class SetNumericFunction : public SqliteFunction {
+  class InterruptFunction : public SqliteFunction {
   public:
-    SetNumericFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    InterruptFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~SetNumericFunction() {}
+    virtual ~InterruptFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "set-numeric"; }
+      getLocalName() const { return "interrupt"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -524,14 +2350,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class SetStringFunction : public SqliteFunction {
+  class BackupFunction : public SqliteFunction {
   public:
-    SetStringFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    BackupFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~SetStringFunction() {}
+    virtual ~BackupFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "set-string"; }
+      getLocalName() const { return "backup"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -540,14 +2366,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class SetNullFunction : public SqliteFunction {
+  class ConnectFromBinaryFunction : public SqliteFunction {
   public:
-    SetNullFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ConnectFromBinaryFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~SetNullFunction() {}
+    virtual ~ConnectFromBinaryFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "set-null"; }
+      getLocalName() const { return "connect-from-binary"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -556,14 +2382,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class ClearParamsFunction : public SqliteFunction {
+  class SerializeFunction : public SqliteFunction {
   public:
-    ClearParamsFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    SerializeFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ClearParamsFunction() {}
+    virtual ~SerializeFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "clear-params"; }
+      getLocalName() const { return "serialize"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -571,15 +2397,15 @@ namespace zorba { namespace sqlite {
                const zorba::DynamicContext*) const;
     
   };
-  
-  class ClosePreparedFunction : public SqliteFunction {
+
+  class RegisterFunctionFunction : public SqliteFunction {
   public:
-    ClosePreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    RegisterFunctionFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ClosePreparedFunction() {}
+    virtual ~RegisterFunctionFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "close-prepared"; }
+      getLocalName() const { return "register-function"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -588,14 +2414,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class ExecuteQueryPreparedFunction : public SqliteFunction {
+  class ClosePoolFunction : public SqliteFunction {
   public:
-    ExecuteQueryPreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    ClosePoolFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ExecuteQueryPreparedFunction() {}
+    virtual ~ClosePoolFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "execute-query-prepared"; }
+      getLocalName() const { return "close-pool"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -604,14 +2430,14 @@ namespace zorba { namespace sqlite {
     
   };
 
-  class ExecuteUpdatePreparedFunction : public SqliteFunction {
+  class InterruptPoolFunction : public SqliteFunction {
   public:
-    ExecuteUpdatePreparedFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
+    InterruptPoolFunction(const SqliteModule* aModule) : SqliteFunction(aModule) {}
 
-    virtual ~ExecuteUpdatePreparedFunction() {}
+    virtual ~InterruptPoolFunction() {}
 
     virtual zorba::String
-      getLocalName() const { return "execute-update-prepared"; }
+      getLocalName() const { return "interrupt-pool"; }
 
     virtual zorba::ItemSequence_t
       evaluate(const Arguments_t&,
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2012 The FLWOR Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZORBA_SQLITE_THREADS_H
+#define ZORBA_SQLITE_THREADS_H
+
+#ifdef WIN32
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <sys/time.h>
+#endif
+
+#include <sqlite3.h>
+
+namespace zorba { namespace sqlite {
+
+/*******************************************************************************
+ * Minimal threading primitives for the module state that outlives a single
+ * query (e.g. the connection pools) and for work done off the query thread.
+ ******************************************************************************/
+  class Mutex
+  {
+    private:
+#ifdef WIN32
+      CRITICAL_SECTION theMutex;
+#else
+      pthread_mutex_t theMutex;
+#endif
+
+      // Not copyable
+      Mutex(const Mutex&);
+      Mutex& operator=(const Mutex&);
+
+      friend class Condition;
+
+    public:
+#ifdef WIN32
+      Mutex() { InitializeCriticalSection(&theMutex); }
+      ~Mutex() { DeleteCriticalSection(&theMutex); }
+      void lock() { EnterCriticalSection(&theMutex); }
+      void unlock() { LeaveCriticalSection(&theMutex); }
+#else
+      Mutex() { pthread_mutex_init(&theMutex, NULL); }
+      ~Mutex() { pthread_mutex_destroy(&theMutex); }
+      void lock() { pthread_mutex_lock(&theMutex); }
+      void unlock() { pthread_mutex_unlock(&theMutex); }
+#endif
+  };
+
+  class MutexLock
+  {
+    private:
+      Mutex& theMutex;
+
+      MutexLock(const MutexLock&);
+      MutexLock& operator=(const MutexLock&);
+
+    public:
+      MutexLock(Mutex& aMutex) : theMutex(aMutex) { theMutex.lock(); }
+      ~MutexLock() { theMutex.unlock(); }
+  };
+
+  class Condition
+  {
+    private:
+#ifdef WIN32
+      CONDITION_VARIABLE theCondition;
+#else
+      pthread_cond_t theCondition;
+#endif
+
+      // Not copyable
+      Condition(const Condition&);
+      Condition& operator=(const Condition&);
+
+    public:
+      // wait() is called with aMutex held, spurious wakeups are possible
+#ifdef WIN32
+      Condition() { InitializeConditionVariable(&theCondition); }
+      ~Condition() {}
+      void wait(Mutex& aMutex)
+        { SleepConditionVariableCS(&theCondition, &aMutex.theMutex, INFINITE); }
+      void signal() { WakeConditionVariable(&theCondition); }
+      void broadcast() { WakeAllConditionVariable(&theCondition); }
+#else
+      Condition() { pthread_cond_init(&theCondition, NULL); }
+      ~Condition() { pthread_cond_destroy(&theCondition); }
+      void wait(Mutex& aMutex) { pthread_cond_wait(&theCondition, &aMutex.theMutex); }
+      void signal() { pthread_cond_signal(&theCondition); }
+      void broadcast() { pthread_cond_broadcast(&theCondition); }
+#endif
+  };
+
+  class Thread
+  {
+    public:
+      typedef void (*Function)(void* aArg);
+
+    private:
+      Function theFunction;
+      void* theArg;
+      bool theStarted;
+#ifdef WIN32
+      HANDLE theThread;
+
+      static DWORD WINAPI
+        run(LPVOID aThread)
+      {
+        Thread* lThread = static_cast<Thread*>(aThread);
+        lThread->theFunction(lThread->theArg);
+        return 0;
+      }
+#else
+      pthread_t theThread;
+
+      static void*
+        run(void* aThread)
+      {
+        Thread* lThread = static_cast<Thread*>(aThread);
+        lThread->theFunction(lThread->theArg);
+        return NULL;
+      }
+#endif
+
+      // Not copyable
+      Thread(const Thread&);
+      Thread& operator=(const Thread&);
+
+    public:
+      Thread(Function aFunction, void* aArg)
+        : theFunction(aFunction), theArg(aArg), theStarted(false) {}
+
+      // A thread still running is waited for
+      ~Thread() { join(); }
+
+      bool
+        start()
+      {
+#ifdef WIN32
+        theThread = CreateThread(NULL, 0, &Thread::run, this, 0, NULL);
+        theStarted = theThread != NULL;
+#else
+        theStarted = pthread_create(&theThread, NULL, &Thread::run, this) == 0;
+#endif
+        return theStarted;
+      }
+
+      void
+        join()
+      {
+        if(!theStarted)
+          return;
+#ifdef WIN32
+        WaitForSingleObject(theThread, INFINITE);
+        CloseHandle(theThread);
+#else
+        pthread_join(theThread, NULL);
+#endif
+        theStarted = false;
+      }
+  };
+
+#ifdef WIN32
+  typedef DWORD ThreadId;
+
+  inline ThreadId
+  currentThreadId() { return GetCurrentThreadId(); }
+
+  inline bool
+  isCurrentThread(ThreadId aThread) { return aThread == GetCurrentThreadId(); }
+#else
+  typedef pthread_t ThreadId;
+
+  inline ThreadId
+  currentThreadId() { return pthread_self(); }
+
+  inline bool
+  isCurrentThread(ThreadId aThread) { return pthread_equal(aThread, pthread_self()) != 0; }
+#endif
+
+  // Milliseconds from an arbitrary starting point, only meant for intervals
+  inline sqlite3_int64
+  currentTimeMillis()
+  {
+#ifdef WIN32
+    return (sqlite3_int64)GetTickCount64();
+#else
+    struct timeval lNow;
+    gettimeofday(&lNow, NULL);
+    return (sqlite3_int64)lNow.tv_sec * 1000 + lNow.tv_usec / 1000;
+#endif
+  }
+
+} /* namespace sqlite  */ } /* namespace zorba */
+
+#endif /* ZORBA_SQLITE_THREADS_H */
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+none immediate none{ "id" : 1, "name" : "committed" }
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+2 2{ "id" : 1, "name" : "carrot", "calories" : 80 }{ "id" : 2, "name" : "tomato", "calories" : 45 }{ "id" : 3, "name" : "apple", "calories" : 95 }{ "id" : 4, "name" : "water", "calories" : null }
\ No newline at end of file
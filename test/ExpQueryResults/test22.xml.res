@@ -0,0 +1 @@
+{ "c" : 2 }{ "capacity" : 1, "size" : 1, "hits" : 2, "misses" : 3, "evictions" : 2 }
\ No newline at end of file
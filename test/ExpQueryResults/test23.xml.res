@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+5{ "live" : 1, "cached" : 0, "in-use" : 0, "prepared" : 1, "internal" : 0 }
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+memory off -4000 memory 250
\ No newline at end of file
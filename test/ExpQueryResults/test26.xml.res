@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+true{ "in-use" : 1, "idle" : 0, "max-size" : 2, "created" : 1, "reused" : 0 }
\ No newline at end of file
@@ -0,0 +1 @@
+[ "id", "name", "calories" ][ 1, "carrot", 80 ][ 2, "tomato", 45 ]{ "id" : [ 1, 2 ], "name" : [ "carrot", "tomato" ], "calories" : [ 80, 45 ] }[ "name" ]
\ No newline at end of file
@@ -0,0 +1 @@
+{ "millis" : 1420070400000, "maxrowid" : 9223372036854775807, "name" : "café" }
\ No newline at end of file
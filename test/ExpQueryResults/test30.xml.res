@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+6 AAABAgMA AQID
\ No newline at end of file
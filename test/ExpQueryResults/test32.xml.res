@@ -0,0 +1 @@
+{ "name" : "carrot", "price" : 1.25, "stamp" : 1420070400000, "data" : "010203" }{ "name" : "tomato", "price" : null, "stamp" : null, "data" : "" }
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+false{ "sql" : "INSERT INTO smalltable (name) VALUES ('one'), ('two'), ('three')", "calls" : 1, "rows" : 0 }{ "sql" : "SELECT name FROM smalltable", "calls" : 2, "rows" : 6 }
\ No newline at end of file
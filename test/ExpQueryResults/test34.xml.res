@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+2 true 0 0 true
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+100 5050 10 label-99 AQI= 1262.5 1 2 3
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+two three true 3
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+orange orange apple apple fried egg fried egg 1 8 884 60 210
\ No newline at end of file
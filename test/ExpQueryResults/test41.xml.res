@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+'cat' 1 true kind owners CASCADE pets name true
\ No newline at end of file
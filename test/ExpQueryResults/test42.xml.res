@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+0 2 1 0 0 2 1 0 rolled back 4 unknown
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+timeout timeout timeout 1000 100
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+1 read-only 4 5 4 5
\ No newline at end of file
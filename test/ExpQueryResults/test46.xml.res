@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+1 Banana 170 0 failed
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+text 12345678901234567.89 real 1.5 out of range
\ No newline at end of file
@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+integer 1420070400000 integer 1420070400000 blob AAEC null
\ No newline at end of file
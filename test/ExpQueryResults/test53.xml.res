@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+1234567 2 1234568 4
\ No newline at end of file
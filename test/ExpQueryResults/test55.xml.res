@@ -0,0 +1,2 @@
+<?xml version="1.0" encoding="UTF-8"?>
+4
\ No newline at end of file
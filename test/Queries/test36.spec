@@ -0,0 +1 @@
+Error: http://zorba.io/modules/sqlite:INVALID-PREPARED-STATEMENT
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2012 The FLWOR Foundation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs queries using the sqlite module from several threads on a single
+ * Zorba instance: connect, prepare, bind, execute and pooled connections
+ * all happen concurrently.
+ *
+ *   sqlite_stress <module path>... [-t threads] [-n iterations]
+ *
+ * Afterwards two queries run one after the other must get the same pooled
+ * connection: the pools outlive the queries.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <zorba/zorba.h>
+#include <zorba/options.h>
+#include <zorba/store_manager.h>
+#include <zorba/static_context.h>
+#include <zorba/xquery.h>
+#include <zorba/zorba_exception.h>
+
+#include "sqlite_threads.h"
+
+using namespace zorba;
+using namespace zorba::sqlite;
+
+namespace {
+
+  // Every query leaves exactly 3 rows in its table
+  const char* theQueries[] = {
+    "import module namespace s = 'http://zorba.io/modules/sqlite';\n"
+    "let $db := s:connect('')\n"
+    "return {\n"
+    "  variable $c := s:execute-update($db, 'CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT)');\n"
+    "  variable $p := s:prepare-statement($db, 'INSERT INTO t (v) VALUES (?)');\n"
+    "  variable $b := s:execute-batch($p, ('a', 'b', 'c'));\n"
+    "  s:close-prepared($p);\n"
+    "  count(s:execute-query($db, 'SELECT * FROM t'))\n"
+    "}",
+
+    "import module namespace s = 'http://zorba.io/modules/sqlite';\n"
+    "let $db := s:connect-pooled('stress', '')\n"
+    "return {\n"
+    "  variable $c := s:execute-update($db, 'CREATE TABLE IF NOT EXISTS t (id INTEGER PRIMARY KEY, v TEXT)');\n"
+    "  variable $d := s:execute-update($db, 'DELETE FROM t');\n"
+    "  variable $p := s:prepare-statement($db, 'INSERT INTO t (v) VALUES (:v)');\n"
+    "  s:bind($p, { 'v' : 'a' }); variable $r1 := s:execute-update-prepared($p);\n"
+    "  s:bind($p, { 'v' : 'b' }); variable $r2 := s:execute-update-prepared($p);\n"
+    "  s:bind($p, { 'v' : 'c' }); variable $r3 := s:execute-update-prepared($p);\n"
+    "  count(s:execute-query($db, 'SELECT * FROM t'))\n"
+    "}"
+  };
+
+  const char* theReusedQuery =
+    "import module namespace s = 'http://zorba.io/modules/sqlite';\n"
+    "let $db := s:connect-pooled('stress', '')\n"
+    "return s:pool-stats('stress')('reused')";
+
+  class Worker
+  {
+    public:
+      Zorba* theZorba;
+      std::vector<String> theModulePaths;
+      int theId;
+      int theIterations;
+      int theFailures;
+      std::string theError;
+  };
+
+  // The serialized result of aText
+  std::string
+  runQuery(Zorba* aZorba, const std::vector<String>& aModulePaths, const char* aText)
+  {
+    StaticContext_t lSctx = aZorba->createStaticContext();
+    lSctx->setModulePaths(aModulePaths);
+    XQuery_t lQuery = aZorba->compileQuery(aText, lSctx);
+    Zorba_SerializerOptions_t lOptions;
+    lOptions.omit_xml_declaration = ZORBA_OMIT_XML_DECLARATION_YES;
+    std::ostringstream lOut;
+    lQuery->execute(lOut, &lOptions);
+    lQuery->close();
+    return lOut.str();
+  }
+
+  void
+  runWorker(void* aWorker)
+  {
+    Worker* lWorker = static_cast<Worker*>(aWorker);
+    for(int i=0; i<lWorker->theIterations; i++)
+    {
+      const char* lText = theQueries[(lWorker->theId + i) % 2];
+      try
+      {
+        std::string lResult =
+          runQuery(lWorker->theZorba, lWorker->theModulePaths, lText);
+        if(lResult != "3")
+        {
+          ++lWorker->theFailures;
+          lWorker->theError = "unexpected result: " + lResult;
+        }
+      }
+      catch (ZorbaException& e)
+      {
+        ++lWorker->theFailures;
+        lWorker->theError = e.what();
+      }
+    }
+  }
+
+} /* namespace */
+
+int
+main(int argc, char* argv[])
+{
+  int lThreads = 8;
+  int lIterations = 50;
+  std::vector<String> lModulePaths;
+
+  for(int i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+      lThreads = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+      lIterations = atoi(argv[++i]);
+    else
+      lModulePaths.push_back(argv[i]);
+  }
+
+  void* lStore = StoreManager::getStore();
+  Zorba* lZorba = Zorba::getInstance(lStore);
+  int lFailures = 0;
+  {
+    std::vector<Worker> lWorkers(lThreads);
+    std::vector<Thread*> lRunning;
+    for(int i=0; i<lThreads; i++)
+    {
+      lWorkers[i].theZorba = lZorba;
+      lWorkers[i].theModulePaths = lModulePaths;
+      lWorkers[i].theId = i;
+      lWorkers[i].theIterations = lIterations;
+      lWorkers[i].theFailures = 0;
+      Thread* lThread = new Thread(&runWorker, &lWorkers[i]);
+      if(!lThread->start())
+      {
+        std::cerr << "can't start thread " << i << std::endl;
+        ++lFailures;
+      }
+      lRunning.push_back(lThread);
+    }
+    for(size_t i=0; i<lRunning.size(); i++)
+    {
+      lRunning[i]->join();
+      delete lRunning[i];
+      if(lWorkers[i].theFailures > 0)
+      {
+        std::cerr << "thread " << i << ": " << lWorkers[i].theFailures
+                  << " failures, last: " << lWorkers[i].theError << std::endl;
+        lFailures += lWorkers[i].theFailures;
+      }
+    }
+  }
+
+  try
+  {
+    long lFirst = atol(runQuery(lZorba, lModulePaths, theReusedQuery).c_str());
+    long lSecond = atol(runQuery(lZorba, lModulePaths, theReusedQuery).c_str());
+    if(lSecond <= lFirst)
+    {
+      std::cerr << "pooled connection not reused: " << lFirst << " then "
+                << lSecond << std::endl;
+      ++lFailures;
+    }
+  }
+  catch (ZorbaException& e)
+  {
+    std::cerr << "pool reuse: " << e.what() << std::endl;
+    ++lFailures;
+  }
+  lZorba->shutdown();
+  StoreManager::shutdownStore(lStore);
+
+  std::cout << lThreads << " threads x " << lIterations << " queries, "
+            << lFailures << " failures" << std::endl;
+  return lFailures == 0 ? 0 : 1;
+}